@@ -83,10 +83,10 @@ int main(int argc, char** argv)
                     continue;
 
                 Smoke* parentModule = 0;
-                if ((parentModule = iter.key()->findClass(parentClass->className).smoke)) {
+                if ((parentModule = iter.key()->findClass(iter.key()->className(*idx)).smoke)) {
                     iter.value().insert(parentModule);
                 } else {
-                    qWarning() << "WARNING: missing parent module for class" << parentClass->className;
+                    qWarning() << "WARNING: missing parent module for class" << iter.key()->className(*idx);
                 }
             }
         }
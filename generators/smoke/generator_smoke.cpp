@@ -45,6 +45,9 @@ QDir Options::libDir;
 QStringList Options::scalarTypes;
 QStringList Options::voidpTypes;
 bool Options::qtMode = false;
+bool Options::castTable = false;
+bool Options::stringTable = false;
+bool Options::hotColdTables = false;
 QList<QRegExp> Options::excludeExpressions;
 QList<QRegExp> Options::includeFunctionNames;
 QList<QRegExp> Options::includeFunctionSignatures;
@@ -58,7 +61,10 @@ static void showUsage()
     "    -pm <comma-seperated list of parent modules>" << std::endl <<
     "    -st <comma-seperated list of types that should be munged to scalars>" << std::endl <<
     "    -vt <comma-seperated list of types that should be mapped to Smoke::t_voidp>" << std::endl <<
-    "    -L <directory containing parent libs> (parent smoke libs can be located in a <modulename> subdirectory>)" << std::endl;
+    "    -L <directory containing parent libs> (parent smoke libs can be located in a <modulename> subdirectory>)" << std::endl <<
+    "    -ct (generate a sorted table of cast functions instead of nested switches)" << std::endl <<
+    "    -sb (store class, type and method names in one string blob, so the tables don't need relocations)" << std::endl <<
+    "    -hc (write the methods table as one array per field, so lookups only load the fields they read)" << std::endl;
 }
 
 extern "C" Q_DECL_EXPORT
@@ -97,6 +103,12 @@ int generate()
             Options::outputDir = QDir(args[++i]);
         } else if (args[i] == "-L") {
             Options::libDir = QDir(args[++i]);
+        } else if (args[i] == "-ct") {
+            Options::castTable = true;
+        } else if (args[i] == "-sb") {
+            Options::stringTable = true;
+        } else if (args[i] == "-hc") {
+            Options::hotColdTables = true;
         } else if (args[i] == "-h" || args[i] == "--help") {
             showUsage();
             return EXIT_SUCCESS;
@@ -123,6 +135,12 @@ int generate()
                 Options::module = elem.text();
             } else if (elem.tagName() == "parts") {
                 Options::parts = elem.text().toInt();
+            } else if (elem.tagName() == "castTable") {
+                Options::castTable = (elem.text() == "true");
+            } else if (elem.tagName() == "stringTable") {
+                Options::stringTable = (elem.text() == "true");
+            } else if (elem.tagName() == "hotColdTables") {
+                Options::hotColdTables = (elem.text() == "true");
             } else if (elem.tagName() == "parentModules") {
                 QDomNode parent = elem.firstChild();
                 while (!parent.isNull()) {
@@ -53,6 +53,9 @@ struct Options
     static QList<QFileInfo> headerList;
     static QStringList classList;
     static bool qtMode;
+    static bool castTable;
+    static bool stringTable;
+    static bool hotColdTables;
     
     static QList<QRegExp> excludeExpressions;
     static QList<QRegExp> includeFunctionNames;
@@ -68,6 +71,8 @@ struct SmokeDataFile
     SmokeDataFile();
 
     void write();
+    void writeCastSwitch(QTextStream& out);
+    void writeCastTable(QTextStream& out);
     bool isClassUsed(const Class* klass);
     QString getTypeFlags(const Type *type, int *classIdx);
     void insertTemplateParameters(const Type& type);
@@ -92,8 +97,9 @@ private:
     void generateMethod(QTextStream& out, const QString& className, const QString& smokeClassName, const Method& meth, int index, QSet<QString>& includes);
     void generateGetAccessor(QTextStream& out, const QString& className, const Field& field, const Type* type, int index);
     void generateSetAccessor(QTextStream& out, const QString& className, const Field& field, const Type* type, int index);
+    void generateTypedFunction(QTextStream& out, const QString& className, const QString& underscoreName, const Method& meth, int index);
     void generateEnumMemberCall(QTextStream& out, const QString& className, const QString& member, int index);
-    void generateVirtualMethod(QTextStream& out, const Method& meth, QSet<QString>& includes);
+    void generateVirtualMethod(QTextStream& out, const Method& meth, int overrideBit, QSet<QString>& includes);
     
     void writeClass(QTextStream& out, const Class* klass, const QString& className, QSet<QString>& includes);
     
@@ -117,6 +123,7 @@ struct Util
     static bool hasClassVirtualDestructor(const Class* klass);
     static bool hasClassPublicDestructor(const Class* klass);
     static const Method* findDestructor(const Class* klass);
+    static bool isStandardLayout(const Class* klass);
 
     static bool derivesFromInvalid(const Class* klass);
 
@@ -135,6 +142,9 @@ struct Util
 
     static QString stackItemField(const Type* type);
     static QString assignmentString(const Type* type, const QString& var);
+    static bool isHeapAllocatedValue(const Type* type);
+    static QString primitiveTypeName(const Type* type);
+    static QString typedSignature(const Method& meth, QString* returnType = 0, QStringList* paramTypes = 0);
     static QList<const Method*> collectVirtualMethods(const Class* klass);
     static const Method* isVirtualOverriden(const Method& meth, const Class* klass);
     static QList<const Method*> virtualMethodsForClass(const Class* klass);
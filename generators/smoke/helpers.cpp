@@ -141,13 +141,13 @@ static Smoke* loadSmokeModule(QString moduleName) {
     return *smoke;
 }
 
-static bool compareArgs(const Method& method, const Smoke::Method& smokeMethod, Smoke* smoke) {
-    if (method.parameters().count() != smokeMethod.numArgs) {
+static bool compareArgs(const Method& method, Smoke::Index smokeMethod, Smoke* smoke) {
+    if (method.parameters().count() != smoke->methodNumArgs(smokeMethod)) {
         return false;
     }
     for (int i = 0; i < method.parameters().count(); i++) {
         const Parameter& p = method.parameters()[i];
-        if (p.type()->toString() != QLatin1String(smoke->types[smoke->argumentList[smokeMethod.args + i]].name)) {
+        if (p.type()->toString() != QLatin1String(smoke->typeName(smoke->argumentList[smoke->methodArgs(smokeMethod) + i]))) {
             return false;
         }
     }
@@ -161,7 +161,7 @@ static bool isRepeating(const QList<Smoke*>& parentModules, const char* classNam
         if (methodIndex.index) {
             Smoke::Index index = methodIndex.smoke->methodMaps[methodIndex.index].method;
             if (index >= 0) {
-                if (compareArgs(method, methodIndex.smoke->methods[index], methodIndex.smoke)) {
+                if (compareArgs(method, index, methodIndex.smoke)) {
                     return true;
                 }
                 continue;
@@ -169,7 +169,7 @@ static bool isRepeating(const QList<Smoke*>& parentModules, const char* classNam
             index = -index;
             Smoke::Index i;
             while ((i = methodIndex.smoke->ambiguousMethodList[index++]) != 0) {
-                if (compareArgs(method, methodIndex.smoke->methods[i], methodIndex.smoke)) {
+                if (compareArgs(method, i, methodIndex.smoke)) {
                     return true;
                 }
             }
@@ -488,6 +488,69 @@ const Method* Util::findDestructor(const Class* klass)
     return 0;
 }
 
+static bool hasNonStaticFields(const Class* klass)
+{
+    foreach (const Field& field, klass->fields()) {
+        if (!(field.flags() & Field::Static))
+            return true;
+    }
+    return false;
+}
+
+// Conservative check whether offsetof() may be used on the class: anything we can't tell for sure is reported
+// as not standard-layout.
+bool Util::isStandardLayout(const Class* klass)
+{
+    static QHash<const Class*, bool> cache;
+    if (cache.contains(klass))
+        return cache[klass];
+
+    // no recursion through members of the same type
+    cache[klass] = false;
+
+    foreach (const Method& meth, klass->methods()) {
+        if (meth.flags() & Method::Virtual || meth.flags() & Method::PureVirtual) {
+            return false;
+        }
+    }
+
+    // all non-static data members have the same access and are standard-layout themselves
+    bool first = true;
+    Access access = Access_public;
+    foreach (const Field& field, klass->fields()) {
+        if (field.flags() & Field::Static)
+            continue;
+        if (!first && field.access() != access)
+            return false;
+        first = false;
+        access = field.access();
+
+        Type type = field.type()->getTypedef() ? field.type()->getTypedef()->resolve() : *field.type();
+        if (type.isRef())
+            return false;
+        if (type.pointerDepth() > 0 || type.getEnum() || type.isIntegral())
+            continue;
+        if (!type.getClass() || !isStandardLayout(type.getClass()))
+            return false;
+    }
+
+    // only one class in the hierarchy may have non-static data members
+    foreach (const Class::BaseClassSpecifier& bspec, klass->baseClasses()) {
+        if (bspec.isVirtual || !isStandardLayout(bspec.baseClass))
+            return false;
+    }
+    int classesWithFields = hasNonStaticFields(klass) ? 1 : 0;
+    foreach (const Class* super, superClassList(klass)) {
+        if (hasNonStaticFields(super))
+            classesWithFields++;
+    }
+    if (classesWithFields > 1)
+        return false;
+
+    cache[klass] = true;
+    return true;
+}
+
 void Util::checkForAbstractClass(Class* klass)
 {
     QList<const Method*> list;
@@ -681,6 +744,71 @@ QString Util::stackItemField(const Type* type)
     return "s_" + typeName;
 }
 
+// The type used for values of the type in typed entry points, or an empty string if the type isn't a plain scalar or enum.
+QString Util::primitiveTypeName(const Type* type)
+{
+    if (type->getTypedef()) {
+        Type resolved = type->getTypedef()->resolve();
+        return primitiveTypeName(&resolved);
+    }
+
+    if (type->pointerDepth() > 0 || type->isRef() || type->isFunctionPointer() || type->isArray() || type->getClass())
+        return QString();
+    // typed entry points are defined outside of x_Foo, so protected enums can't be used
+    if (type->getEnum() && type->getEnum()->access() != Access_public)
+        return QString();
+
+    static QHash<QString, QString> primitiveTypes;
+    if (primitiveTypes.isEmpty()) {
+        primitiveTypes["s_bool"] = "bool";
+        primitiveTypes["s_char"] = "signed char";
+        primitiveTypes["s_uchar"] = "unsigned char";
+        primitiveTypes["s_short"] = "short";
+        primitiveTypes["s_ushort"] = "unsigned short";
+        primitiveTypes["s_int"] = "int";
+        primitiveTypes["s_uint"] = "unsigned int";
+        primitiveTypes["s_long"] = "long";
+        primitiveTypes["s_ulong"] = "unsigned long";
+        primitiveTypes["s_float"] = "float";
+        primitiveTypes["s_double"] = "double";
+        primitiveTypes["s_enum"] = "long";
+    }
+    return primitiveTypes.value(stackItemField(type));
+}
+
+// The native signature of the typed entry point of the method, e.g. "int (void*, bool)", or an empty string if it doesn't
+// get one. Only public non-virtual methods taking and returning scalars and enums qualify.
+QString Util::typedSignature(const Method& meth, QString* returnType, QStringList* paramTypes)
+{
+    // default values are written as they are in the class scope, they might not compile outside of it
+    if (meth.access() != Access_public || meth.isConstructor() || meth.isDestructor() || fieldAccessors.contains(&meth)
+        || !meth.remainingDefaultValues().isEmpty()
+        || (meth.flags() & Method::Virtual) || (meth.flags() & Method::PureVirtual) || virtualMethodsForClass(meth.getClass()).contains(&meth))
+    {
+        return QString();
+    }
+
+    QString ret = "void";
+    if (meth.type() != Type::Void && (ret = primitiveTypeName(meth.type())).isEmpty())
+        return QString();
+
+    QStringList params;
+    if (!(meth.flags() & Method::Static))
+        params << "void*";
+    foreach (const Parameter& param, meth.parameters()) {
+        QString type = primitiveTypeName(param.type());
+        if (type.isEmpty())
+            return QString();
+        params << type;
+    }
+
+    if (returnType)
+        *returnType = ret;
+    if (paramTypes)
+        *paramTypes = params;
+    return ret + " (" + params.join(", ") + ')';
+}
+
 QString Util::assignmentString(const Type* type, const QString& var)
 {
     if (type->getTypedef()) {
@@ -707,6 +835,25 @@ QString Util::assignmentString(const Type* type, const QString& var)
     return QString();
 }
 
+// Whether assignmentString() copies values of this type to the heap, i.e. it's a class passed by value.
+bool Util::isHeapAllocatedValue(const Type* type)
+{
+    if (type->getTypedef()) {
+        Type resolved = type->getTypedef()->resolve();
+        return isHeapAllocatedValue(&resolved);
+    }
+
+    if (type == Type::Void || type->pointerDepth() > 0 || type->isFunctionPointer() || type->isRef() || type->isArray())
+        return false;
+    if (type->isIntegral() && !Options::voidpTypes.contains(type->name()))
+        return false;
+    if (type->getEnum())
+        return false;
+    if (Options::qtMode && type->getClass() && type->getClass()->isTemplate() && type->getClass()->name() == "QFlags")
+        return false;
+    return true;
+}
+
 QList<const Method*> Util::collectVirtualMethods(const Class* klass)
 {
     QList<const Method*> methods;
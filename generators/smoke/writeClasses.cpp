@@ -25,10 +25,29 @@
 #include <QTextStream>
 
 #include <type.h>
+#include <smoke.h>
 
 #include "globals.h"
 #include "../../options.h"
 
+// Whether values of this type are returned with Smoke::cc_returnInPlace. That needs a class of a smoke module
+// (this one or a parent), so that the binding knows the size and alignment of the buffer from its Class entry.
+// Templates, voidp types and unknown classes are always copied to the heap.
+static bool isReturnedInPlace(const Type* type, const SmokeDataFile* data)
+{
+    if (type->getTypedef()) {
+        Type resolved = type->getTypedef()->resolve();
+        return isReturnedInPlace(&resolved, data);
+    }
+
+    if (!Util::isHeapAllocatedValue(type) || Options::voidpTypes.contains(type->name()))
+        return false;
+    const Class* klass = type->getClass();
+    if (!klass || klass->isTemplate() || klass->isNameSpace())
+        return false;
+    return data->classIndex.contains(klass->toString());
+}
+
 SmokeClassFiles::SmokeClassFiles(SmokeDataFile *data)
     : m_smokeData(data)
 {
@@ -80,8 +99,6 @@ void SmokeClassFiles::write(const QList<QString>& keys)
 
         fileOut << "\n#include <smoke.h>\n#include <" << Options::module << "_smoke.h>\n";
 
-        fileOut << "\nclass __internal_SmokeClass {};\n";
-
         fileOut << "\nnamespace __smoke" << Options::module << " {\n\n";
 
         // now the class code
@@ -98,11 +115,13 @@ QString SmokeClassFiles::generateMethodBody(const QString& indent, const QString
 {
     QString methodBody;
     QTextStream out(&methodBody);
-
-    out << indent;
+    // the declaration of xret and the call itself
+    QString declaration;
+    QString call;
+    QTextStream callOut(&call);
 
     if (meth.isConstructor()) {
-        out << smokeClassName << "* xret = new " << smokeClassName << "(";
+        callOut << smokeClassName << "(";
     } else {
         const Function* func = Util::globalFunctionMap[&meth];
         if (func)
@@ -112,25 +131,25 @@ QString SmokeClassFiles::generateMethodBody(const QString& indent, const QString
             includes.insert(meth.type()->getClass()->fileName());
 
         if (meth.type()->isFunctionPointer() || meth.type()->isArray())
-            out << meth.type()->toString("xret") << " = ";
+            declaration = meth.type()->toString("xret") + " = ";
         else if (meth.type() != Type::Void)
-            out << meth.type()->toString() << " xret = ";
+            declaration = meth.type()->toString() + " xret = ";
 
         if (!(meth.flags() & Method::Static)) {
             if (meth.isConst()) {
-                out << "((const " << smokeClassName << "*)this)->";
+                callOut << "((const " << smokeClassName << "*)this)->";
             } else {
-                out << "this->";
+                callOut << "this->";
             }
         }
         if (!dynamicDispatch && !func) {
             // dynamic dispatch not wanted, call with 'this->Foo::method()'
-            out << className << "::";
+            callOut << className << "::";
         } else if (func) {
             if (!func->nameSpace().isEmpty())
-                out << func->nameSpace() << "::";
+                callOut << func->nameSpace() << "::";
         }
-        out << meth.name() << "(";
+        callOut << meth.name() << "(";
     }
 
     for (int j = 0; j < meth.parameters().count(); j++) {
@@ -139,7 +158,7 @@ QString SmokeClassFiles::generateMethodBody(const QString& indent, const QString
         if (param.type()->getClass())
             includes.insert(param.type()->getClass()->fileName());
 
-        if (j > 0) out << ",";
+        if (j > 0) callOut << ",";
 
         QString field = Util::stackItemField(param.type());
         QString typeName = param.type()->toString();
@@ -148,26 +167,53 @@ QString SmokeClassFiles::generateMethodBody(const QString& indent, const QString
             t.setPointerDepth(t.pointerDepth() + 1);
             t.setIsRef(false);
             typeName = t.toString();
-            out << '*';
+            callOut << '*';
         } else if (field == "s_class" && (param.type()->pointerDepth() == 0 || param.type()->isRef()) && !param.type()->isFunctionPointer()) {
             // references and classes are passed in s_class
             typeName.append('*');
-            out << '*';
+            callOut << '*';
         }
         // casting to a reference doesn't make sense in this case
         if (param.type()->isRef() && !param.type()->isFunctionPointer()) typeName.replace('&', "");
-        out << "(" << typeName << ")" << "x[" << j + 1 << "]." << field;
+        callOut << "(" << typeName << ")" << "x[" << j + 1 << "]." << field;
     }
 
     // if the method has any other default parameters, append them here as values
     if (!meth.remainingDefaultValues().isEmpty()) {
         const QStringList& defaultParams = meth.remainingDefaultValues();
         if (meth.parameters().count() > 0)
-            out << "," ;
-        out << defaultParams.join(",");
+            callOut << "," ;
+        callOut << defaultParams.join(",");
+    }
+
+    callOut << ")";
+    callOut.flush();
+
+    if (!meth.isConstructor() && isReturnedInPlace(meth.type(), m_smokeData)) {
+        // with Smoke::cc_returnInPlace the binding passes storage for the return value in x[0]
+        includes.insert("new");
+        out << indent << "if (" << Options::module << "_Smoke->callingConvention & Smoke::cc_returnInPlace) {\n";
+        out << indent << "    x[0].s_class = (void*)new (x[0].s_voidp) " << meth.type()->toString() << '(' << call << ");\n";
+        out << indent << "} else {\n";
+        out << indent << "    " << declaration << call << ";\n";
+        out << indent << "    x[0].s_class = " << Util::assignmentString(meth.type(), "xret") << ";\n";
+        out << indent << "}\n";
+        return methodBody;
     }
 
-    out << ");\n";
+    if (meth.isConstructor()) {
+        // with Smoke::cc_constructInPlace the binding can pass storage for the instance in x[0]
+        includes.insert("new");
+        out << indent << smokeClassName << "* xret;\n";
+        out << indent << "if ((" << Options::module << "_Smoke->callingConvention & Smoke::cc_constructInPlace) && x[0].s_voidp)\n";
+        out << indent << "    xret = new (x[0].s_voidp) " << call << ";\n";
+        out << indent << "else\n";
+        out << indent << "    xret = new " << call << ";\n";
+        out << indent << "x[0].s_class = (void*)xret;\n";
+        return methodBody;
+    }
+
+    out << indent << declaration << call << ";\n";
     if (meth.type() != Type::Void) {
         out << indent << "x[0]." << Util::stackItemField(meth.type()) << " = " << Util::assignmentString(meth.type(), "xret") << ";\n";
     } else {
@@ -194,9 +240,13 @@ void SmokeClassFiles::generateMethod(QTextStream& out, const QString& className,
         out << generateMethodBody("        ",   // indent
                                   className, smokeClassName, meth, index, dynamicDispatch, includes);
     } else {
-        // This is a virtual method. To know whether we should call with dynamic dispatch, we need a bit of RTTI magic.
+        // This is a virtual method. Instances created by the binding have to be called without dynamic dispatch, else
+        // we would end up in the binding again. The generated subclasses record their types, so a typeid() tells them
+        // apart. The common case of an instance of this very subclass is an inline compare, only other types need the
+        // lookup in the registry.
         includes.insert("typeinfo");
-        out << "        if (dynamic_cast<__internal_SmokeClass*>(static_cast<" << className << "*>(this))) {\n";   //
+        out << "        const std::type_info& xtype = typeid(*static_cast<" << className << "*>(this));\n";
+        out << "        if (&xtype == &typeid(" << smokeClassName << ") || Smoke::isBindingType(xtype)) {\n";
         out << generateMethodBody("            ",   // indent
                                   className, smokeClassName, meth, index, false, includes);
         out << "        } else {\n";
@@ -264,6 +314,43 @@ void SmokeClassFiles::generateSetAccessor(QTextStream& out, const QString& class
     out << "    }\n";
 }
 
+void SmokeClassFiles::generateTypedFunction(QTextStream& out, const QString& className, const QString& underscoreName,
+                                            const Method& meth, int index)
+{
+    QString returnType;
+    QStringList paramTypes;
+    if (Util::typedSignature(meth, &returnType, &paramTypes).isEmpty())
+        return;
+
+    bool isStatic = meth.flags() & Method::Static;
+    out << returnType << " xtfn_" << underscoreName << '_' << index << '(';
+    QStringList args;
+    for (int i = 0; i < paramTypes.count(); i++) {
+        if (i > 0) out << ", ";
+        if (i == 0 && !isStatic) {
+            out << "void *xself";
+            continue;
+        }
+        int j = isStatic ? i : i - 1;
+        out << paramTypes[i] << " x" << j + 1;
+        args << '(' + meth.parameters()[j].type()->toString() + ")x" + QString::number(j + 1);
+    }
+    out << ") { ";
+    if (meth.type() != Type::Void)
+        out << "return (" << returnType << ')';
+
+    const Function* func = Util::globalFunctionMap[&meth];
+    if (func) {
+        if (!func->nameSpace().isEmpty())
+            out << func->nameSpace() << "::";
+    } else if (isStatic) {
+        out << className << "::";
+    } else {
+        out << "((" << className << "*)xself)->";
+    }
+    out << meth.name() << '(' << args.join(", ") << "); }\n";
+}
+
 void SmokeClassFiles::generateEnumMemberCall(QTextStream& out, const QString& className, const QString& member, int index)
 {
     out << "    static void x_" << index << "(Smoke::Stack x) {\n"
@@ -276,7 +363,7 @@ void SmokeClassFiles::generateEnumMemberCall(QTextStream& out, const QString& cl
         << "    }\n";
 }
 
-void SmokeClassFiles::generateVirtualMethod(QTextStream& out, const Method& meth, QSet<QString>& includes)
+void SmokeClassFiles::generateVirtualMethod(QTextStream& out, const Method& meth, int overrideBit, QSet<QString>& includes)
 {
     QString x_params, x_list;
     QString type = meth.type()->toString();
@@ -309,6 +396,11 @@ void SmokeClassFiles::generateVirtualMethod(QTextStream& out, const Method& meth
         out << ") ";
     }
     out << "{\n";
+    if (!(meth.flags() & Method::PureVirtual)) {
+        // skip the binding if it doesn't override the method for this instance
+        out << QString("        if (!(this->_overridden[%1] & %2)) return this->%3::%4(%5);\n")
+            .arg(overrideBit / 8).arg(1 << (overrideBit % 8)).arg(meth.getClass()->toString()).arg(meth.name()).arg(x_list);
+    }
     out << QString("        Smoke::StackItem x[%1];\n").arg(meth.parameters().count() + 1);
     out << x_params;
     
@@ -363,24 +455,65 @@ void SmokeClassFiles::writeClass(QTextStream& out, const Class* klass, const QSt
 
     QString switchCode;
     QTextStream switchOut(&switchCode);
+    // direct entry points for Smoke::methodFns, one per Smoke::Method
+    QString thunkCode;
+    QTextStream thunkOut(&thunkCode);
 
     out << QString("class %1").arg(smokeClassName);
     if (!klass->isNameSpace()) {
         out << QString(" : public %1").arg(className);
-        if (Util::hasClassVirtualDestructor(klass) && Util::hasClassPublicDestructor(klass)) {
-            out << ", public __internal_SmokeClass";
-        }
     }
     out << " {\n";
+    const QList<const Method*> virtualMethods = Util::virtualMethodsForClass(klass);
     if (Util::canClassBeInstanciated(klass)) {
         out << "    SmokeBinding* _binding;\n";
+        out << "    bool _notifyDeleted;\n";
+        if (!virtualMethods.isEmpty()) {
+            // one bit per entry of virtualMethods, see Smoke::setMethodOverridden()
+            out << "    unsigned char _overridden[" << (virtualMethods.count() + 7) / 8 << "];\n";
+        }
         out << "public:\n";
         out << "    void x_0(Smoke::Stack x) {\n";
         out << "        // set the smoke binding\n";
         out << "        _binding = (SmokeBinding*)x[1].s_class;\n";
+        out << "        _notifyDeleted = true;\n";
+        if (!virtualMethods.isEmpty())
+            out << "        memset(_overridden, 0xff, sizeof(_overridden));\n";
+        if (!virtualMethods.isEmpty() || Util::hasClassVirtualDestructor(klass)) {
+            includes.insert("typeinfo");
+            // only the first instance of the class touches the registry
+            out << "        static const bool xregistered = (Smoke::addBindingType(typeid(" << smokeClassName << ")), true);\n";
+            out << "        (void) xregistered;\n";
+        }
         out << "    }\n";
         
         switchOut << "        case 0: xself->x_0(args);\tbreak;\n";
+        switchOut << "        case " << Smoke::InstanceLayout << ": args[0].s_uint = sizeof(" << smokeClassName << "); "
+                  << "args[1].s_uint = SMOKE_ALIGNOF(" << smokeClassName << ");\tbreak;\n";
+        out << "    void x_setDeletedNotification(Smoke::Stack x) {\n";
+        out << "        // whether the destructor tells the binding\n";
+        out << "        _notifyDeleted = x[1].s_bool;\n";
+        out << "    }\n";
+        switchOut << "        case " << Smoke::SetDeletedNotification << ": xself->x_setDeletedNotification(args);\tbreak;\n";
+        
+        if (!virtualMethods.isEmpty()) {
+            out << "    void x_setOverridden(Smoke::Stack x) {\n";
+            out << "        // x[1]: the virtual method (index into methods), 0 for all; x[2]: overridden or not\n";
+            out << "        static const Smoke::Index xmethods[] = { ";
+            for (int i = 0; i < virtualMethods.count(); i++) {
+                if (i > 0) out << ", ";
+                out << m_smokeData->methodIdx[virtualMethods[i]];
+            }
+            out << " };\n";
+            out << "        for (int i = 0; i < " << virtualMethods.count() << "; i++) {\n";
+            out << "            if (x[1].s_int && xmethods[i] != x[1].s_int) continue;\n";
+            out << "            if (x[2].s_bool) _overridden[i >> 3] |= (1 << (i & 7));\n";
+            out << "            else _overridden[i >> 3] &= ~(1 << (i & 7));\n";
+            out << "        }\n";
+            out << "    }\n";
+            
+            switchOut << "        case " << Smoke::SetOverriddenMethod << ": xself->x_setOverridden(args);\tbreak;\n";
+        }
     } else {
         out << "public:\n";
     }
@@ -397,6 +530,10 @@ void SmokeClassFiles::writeClass(QTextStream& out, const Class* klass, const QSt
         switchOut << "        case " << xcall_index << ": "
                   << (((meth.flags() & Method::Static) || meth.isConstructor()) ? smokeClassName + "::" : "xself->")
                   << "x_" << xcall_index << "(args);\tbreak;\n";
+        thunkOut << "void xfn_" << underscoreName << '_' << xcall_index << "(void *obj, Smoke::Stack args) { "
+                 << (((meth.flags() & Method::Static) || meth.isConstructor()) ? smokeClassName + "::" : "((" + smokeClassName + "*)obj)->")
+                 << "x_" << xcall_index << "(args); }\n";
+        generateTypedFunction(thunkOut, className, underscoreName, meth, xcall_index);
         if (Util::fieldAccessors.contains(&meth)) {
             // accessor method?
             const Field* field = Util::fieldAccessors[&meth];
@@ -421,12 +558,18 @@ void SmokeClassFiles::writeClass(QTextStream& out, const Class* klass, const QSt
         if (e->access() == Access_private)
             continue;
         
+        const QString scope = e->parent() ? className : e->nameSpace();
         foreach (const EnumMember& member, e->members()) {
+            if (e->access() == Access_public) {
+                // the value is in the enumValues table as well, no direct entry point needed
+                switchOut << "        case " << xcall_index++ << ": args[0].s_enum = (long)"
+                          << (scope.isEmpty() ? QString() : scope + "::") << member.name() << ";\tbreak;\n";
+                continue;
+            }
             switchOut << "        case " << xcall_index << ": " << smokeClassName <<  "::x_" << xcall_index << "(args);\tbreak;\n";
-            if (e->parent())
-                generateEnumMemberCall(out, className, member.name(), xcall_index++);
-            else
-                generateEnumMemberCall(out, e->nameSpace(), member.name(), xcall_index++);
+            thunkOut << "void xfn_" << underscoreName << '_' << xcall_index << "(void *, Smoke::Stack args) { "
+                     << smokeClassName << "::x_" << xcall_index << "(args); }\n";
+            generateEnumMemberCall(out, scope, member.name(), xcall_index++);
         }
         
         // only generate the xenum_call if the enum has a valid name
@@ -455,8 +598,8 @@ void SmokeClassFiles::writeClass(QTextStream& out, const Class* klass, const QSt
         enumOut << "            break;\n";
     }
     
-    foreach (const Method* meth, Util::virtualMethodsForClass(klass)) {
-        generateVirtualMethod(out, *meth, includes);
+    for (int i = 0; i < virtualMethods.count(); i++) {
+        generateVirtualMethod(out, *virtualMethods[i], i, includes);
     }
     
     // this class contains enums, write out an xenum_operation method
@@ -480,7 +623,7 @@ void SmokeClassFiles::writeClass(QTextStream& out, const Class* klass, const QSt
             }
             out << ") ";
         }
-        out << QString("{ this->_binding->deleted(%1, (void*)this); }\n").arg(m_smokeData->classIndex[className]);
+        out << QString("{ if (this->_notifyDeleted) this->_binding->objectDeleted(%1, (void*)this); }\n").arg(m_smokeData->classIndex[className]);
     }
     out << "};\n";
     
@@ -495,8 +638,19 @@ void SmokeClassFiles::writeClass(QTextStream& out, const Class* klass, const QSt
     out << "    " << smokeClassName << " *xself = (" << smokeClassName << "*)obj;\n";
     out << "    switch(xi) {\n";
     out << switchCode;
-    if (Util::hasClassPublicDestructor(klass))
+    if (Util::hasClassPublicDestructor(klass)) {
         out << "        case " << xcall_index << ": delete (" << className << "*)xself;\tbreak;\n";
+        if (Util::canClassBeInstanciated(klass)) {
+            // instances constructed in place are of the generated subclass, returned values aren't
+            out << "        case " << Smoke::DestroyInPlace << ": if (args[1].s_bool) Smoke::destroy((" << className
+                << "*)xself); else Smoke::destroy(xself);\tbreak;\n";
+        } else {
+            out << "        case " << Smoke::DestroyInPlace << ": Smoke::destroy((" << className << "*)xself);\tbreak;\n";
+        }
+        thunkOut << "void xfn_" << underscoreName << '_' << xcall_index << "(void *obj, Smoke::Stack) { "
+                 << "delete (" << className << "*)(" << smokeClassName << "*)obj; }\n";
+    }
     out << "    }\n";
     out << "}\n";
+    out << thunkCode;
 }
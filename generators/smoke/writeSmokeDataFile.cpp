@@ -23,7 +23,10 @@
 #include <QMap>
 #include <QTextStream>
 
+#include <limits>
+
 #include <type.h>
+#include <smoke.h>
 
 #include "globals.h"
 #include "../../options.h"
@@ -35,6 +38,136 @@ uint qHash(const QVector<int> intList)
     return qHash(QByteArray::fromRawData(byteArray, length));
 }
 
+// Smoke::Index is a short unless smokegen was built with SMOKE_32BIT_INDEX, make sure all tables fit. The size
+// itself has to fit as well, it's used as the end of ranges.
+static void checkIndexRange(const char *table, int size)
+{
+    if (size > std::numeric_limits<Smoke::Index>::max()) {
+        qFatal("%s has %d entries, but Smoke::Index only allows %d. Rebuild smokegen with -DSMOKE_32BIT_INDEX=ON or split the module.",
+               table, size, (int) std::numeric_limits<Smoke::Index>::max());
+    }
+}
+
+// Writes out an open-addressing hash table for the name lookups in smoke.h. The name at position i in 'names'
+// has the index i + 1 in its table. Returns the mask (table size - 1) that has to be passed along with the table.
+static int writeHashTable(QTextStream& out, const QString& tableName, const QStringList& names)
+{
+    // keep the load factor at or below 0.5, so lookups rarely need more than one probe
+    int size = 2;
+    while (size < names.count() * 2)
+        size <<= 1;
+    const unsigned int mask = size - 1;
+
+    QVector<int> slots(size, 0);
+    for (int i = 0; i < names.count(); i++) {
+        unsigned int slot = Smoke::hashString(names[i].toLatin1().constData()) & mask;
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = i + 1;
+    }
+
+    out << "static const Smoke::Index " << tableName << "[] = {";
+    for (int i = 0; i < size; i++) {
+        if (i % 16 == 0)
+            out << "\n    ";
+        out << slots[i] << ',';
+    }
+    out << "\n};\n\n";
+    return mask;
+}
+
+// Collects the names for Options::stringTable. Equal names share one entry, offset 0 is the leading '\0'
+// of the blob and stands for a null name.
+struct StringBlob
+{
+    StringBlob() : size(1) {}
+
+    int add(const QString& str) {
+        QHash<QString, int>::const_iterator it = offsets.constFind(str);
+        if (it != offsets.constEnd())
+            return it.value();
+        int offset = size;
+        offsets[str] = offset;
+        strings << str;
+        size += str.toLatin1().size() + 1;
+        return offset;
+    }
+
+    // Written as a brace initializer rather than one concatenated string literal, whose length some compilers limit
+    // (64K with MSVC).
+    void write(QTextStream& out) const {
+        out << "static const char strings[] = {\n";
+        out << "    0,\t// 0 (no name)\n";
+        foreach (const QString& str, strings) {
+            out << "    ";
+            foreach (char c, str.toLatin1()) {
+                if (c == '\'' || c == '\\')
+                    out << "'\\" << c << "',";
+                else
+                    out << '\'' << c << "',";
+            }
+            out << "0,\t// " << offsets[str] << ' ' << str << "\n";
+        }
+        out << "};\n\n";
+    }
+
+    QHash<QString, int> offsets;
+    QStringList strings;
+    int size;
+};
+
+static void writeOffsetTable(QTextStream& out, const QString& tableName, const QVector<int>& offsets)
+{
+    out << "static const unsigned int " << tableName << "[] = {";
+    for (int i = 0; i < offsets.count(); i++) {
+        if (i % 16 == 0)
+            out << "\n    ";
+        out << offsets[i] << ',';
+    }
+    out << "\n};\n\n";
+}
+
+// The columns of Smoke::HotTables, for Options::hotColdTables. Each list is parallel to the methods table.
+struct HotColumns
+{
+    void addMethod(int classId, int name, int args, int numArgs, const QString& flags, int ret, int callIndex, int signature) {
+        methodClassIds << QString::number(classId);
+        methodNameIds << QString::number(name);
+        methodArgs << QString::number(args);
+        methodNumArgs << QString::number(numArgs);
+        methodFlags << flags;
+        methodReturnTypes << QString::number(ret);
+        methodCallIndices << QString::number(callIndex);
+        methodSignatures << QString::number(signature);
+    }
+
+    QStringList methodClassIds;
+    QStringList methodNameIds;
+    QStringList methodArgs;
+    QStringList methodNumArgs;
+    QStringList methodFlags;
+    QStringList methodReturnTypes;
+    QStringList methodCallIndices;
+    QStringList methodSignatures;
+};
+
+static void writeColumn(QTextStream& out, const QString& type, const QString& tableName, const QStringList& values)
+{
+    out << "static const " << type << ' ' << tableName << "[] = {";
+    for (int i = 0; i < values.count(); i++) {
+        if (i % 8 == 0)
+            out << "\n    ";
+        out << values[i] << ", ";
+    }
+    out << "\n};\n\n";
+}
+
+// The name column of classes and types; 0 if the name is in the string blob.
+static QString nameLiteral(const QString& name)
+{
+    return Options::stringTable ? QString("0L") : QString("\"%1\"").arg(name);
+}
+
 SmokeDataFile::SmokeDataFile()
 {
     qDebug("preparing SMOKE data [%s]", qPrintable(Options::module));
@@ -100,6 +233,139 @@ SmokeDataFile::SmokeDataFile()
     }
 }
 
+void SmokeDataFile::writeCastSwitch(QTextStream& out)
+{
+    out << "static void *cast(void *xptr, Smoke::Index from, Smoke::Index to) {\n";
+    out << "  switch(from) {\n";
+    for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
+        const Class& klass = classes[iter.key()];
+        if (klass.isNameSpace())
+            continue;
+        
+        QSet<int> indices; // avoid duplicate case values (diamond-shaped inheritance)
+        
+        out << "    case " << iter.value() << ":   //" << iter.key() << "\n";
+        out << "      switch(to) {\n";
+        foreach (const Class* base, Util::superClassList(&klass)) {
+            QString className = base->toString();
+            
+            if (includedClasses.contains(className) || externalClasses.contains((Class *) base)) {
+                int index = classIndex[className];
+                if (indices.contains(index))
+                    continue;
+                indices << index;
+                
+                out << QString("        case %1: return (void*)(%2*)(%3*)xptr;\n")
+                    .arg(index).arg(className).arg(klass.toString());
+            }
+        }
+        out << QString("        case %1: return (void*)(%2*)xptr;\n").arg(iter.value()).arg(klass.toString());
+        foreach (const Class* desc, Util::descendantsList(&klass)) {
+            QString className = desc->toString();
+            
+            if (includedClasses.contains(className)) {
+                int index = classIndex[className];
+                if (indices.contains(index))
+                    continue;
+                indices << index;
+                
+                if (Util::isVirtualInheritancePath(desc, &klass)) {
+                    out << QString("        case %1: return (void*)dynamic_cast<%2*>((%3*)xptr);\n")
+                        .arg(index).arg(className).arg(klass.toString());
+                } else {
+                    out << QString("        case %1: return (void*)(%2*)(%3*)xptr;\n")
+                        .arg(index).arg(className).arg(klass.toString());
+                }
+            }
+        }
+        out << "        default: return xptr;\n";
+        out << "      }\n";
+    }
+    out << "    default: return xptr;\n";
+    out << "  }\n";
+    out << "}\n\n";
+}
+
+// Writes out the cast function as a lookup in a sorted table of small cast functions, one per pair of classes. The
+// compiler does the pointer adjustment in each, so no offsets have to be computed from made-up pointers.
+void SmokeDataFile::writeCastTable(QTextStream& out)
+{
+    QString thunks;
+    QTextStream thunksOut(&thunks);
+    QString entries;
+    QTextStream entriesOut(&entries);
+    QStringList start;
+    int count = 1;
+
+    start << "0";
+    for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
+        start << QString::number(count);
+        const Class& klass = classes[iter.key()];
+        if (klass.isNameSpace())
+            continue;
+
+        // sorted by target index, tableCast() does a binary search on it
+        QMap<int, QString> casts;
+        QHash<int, QString> targetNames;
+        foreach (const Class* base, Util::superClassList(&klass)) {
+            QString className = base->toString();
+            if (!includedClasses.contains(className) && !externalClasses.contains((Class *) base))
+                continue;
+            int index = classIndex[className];
+            if (casts.contains(index))
+                continue;
+
+            targetNames[index] = className;
+            thunksOut << QString("static void *xcast_%1_%2(void *xptr) { return (void*)(%3*)(%4*)xptr; }\n")
+                .arg(iter.value()).arg(index).arg(className).arg(klass.toString());
+            casts[index] = QString("{ %1, xcast_%2_%1 }").arg(index).arg(iter.value());
+        }
+        foreach (const Class* desc, Util::descendantsList(&klass)) {
+            QString className = desc->toString();
+            if (!includedClasses.contains(className))
+                continue;
+            int index = classIndex[className];
+            if (casts.contains(index))
+                continue;
+
+            targetNames[index] = className;
+            if (Util::isVirtualInheritancePath(desc, &klass)) {
+                thunksOut << QString("static void *xcast_%1_%2(void *xptr) { return (void*)dynamic_cast<%3*>((%4*)xptr); }\n")
+                    .arg(iter.value()).arg(index).arg(className).arg(klass.toString());
+            } else {
+                thunksOut << QString("static void *xcast_%1_%2(void *xptr) { return (void*)(%3*)(%4*)xptr; }\n")
+                    .arg(iter.value()).arg(index).arg(className).arg(klass.toString());
+            }
+            casts[index] = QString("{ %1, xcast_%2_%1 }").arg(index).arg(iter.value());
+        }
+
+        for (QMap<int, QString>::const_iterator it = casts.constBegin(); it != casts.constEnd(); it++) {
+            entriesOut << "    " << it.value() << ",\t//" << count++ << ": " << iter.key() << " -> " << targetNames[it.key()] << "\n";
+        }
+    }
+    start << QString::number(count);
+
+    out << thunks;
+    if (!thunks.isEmpty())
+        out << "\n";
+    out << "// castTable[castTableStart[from] .. castTableStart[from + 1]) are the classes 'from' can be cast to,\n";
+    out << "// sorted by their index.\n";
+    out << "static const Smoke::CastEntry castTable[] = {\n";
+    out << "    { 0, 0 },\t//0: (no cast)\n";
+    out << entries;
+    out << "};\n\n";
+
+    out << "static const unsigned int castTableStart[] = {\n";
+    for (int i = 0; i < start.count(); i += 16) {
+        out << "    " << QStringList(start.mid(i, 16)).join(", ") << ",\n";
+    }
+    out << "};\n\n";
+
+    out << "static void *cast(void *xptr, Smoke::Index from, Smoke::Index to) {\n";
+    out << "    return Smoke::tableCast(castTable, castTableStart, xptr, from, to);\n";
+    out << "}\n\n";
+}
+
 void SmokeDataFile::insertTemplateParameters(const Type& type)
 {
     foreach(const Type& t, type.templateArguments()) {
@@ -158,6 +424,9 @@ QString SmokeDataFile::getTypeFlags(const Type *t, int *classIdx)
         flags += typeName;
     } else if (t->getEnum()) {
         flags += "|Smoke::t_enum";
+        // size and signedness, so bindings can store the values themselves; only public enums can be named here
+        if (t->getEnum()->access() == Access_public && !t->getEnum()->name().isEmpty())
+            flags += "|Smoke::EnumTypeFlags<" + t->getEnum()->toString() + " >::value";
         if (t->getEnum()->parent()) {
             *classIdx = classIndex.value(t->getEnum()->parent()->toString(), 0);
         } else if (!t->getEnum()->nameSpace().isEmpty()) {
@@ -201,55 +470,10 @@ void SmokeDataFile::write()
     out << "namespace " << smokeNamespaceName  << " {\n\n";
     
     // write out Options::module_cast() function
-    out << "static void *cast(void *xptr, Smoke::Index from, Smoke::Index to) {\n";
-    out << "  switch(from) {\n";
-    for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
-        const Class& klass = classes[iter.key()];
-        if (klass.isNameSpace())
-            continue;
-        
-        QSet<int> indices; // avoid duplicate case values (diamond-shaped inheritance)
-        
-        out << "    case " << iter.value() << ":   //" << iter.key() << "\n";
-        out << "      switch(to) {\n";
-        foreach (const Class* base, Util::superClassList(&klass)) {
-            QString className = base->toString();
-            
-            if (includedClasses.contains(className) || externalClasses.contains((Class *) base)) {
-                int index = classIndex[className];
-                if (indices.contains(index))
-                    continue;
-                indices << index;
-                
-                out << QString("        case %1: return (void*)(%2*)(%3*)xptr;\n")
-                    .arg(index).arg(className).arg(klass.toString());
-            }
-        }
-        out << QString("        case %1: return (void*)(%2*)xptr;\n").arg(iter.value()).arg(klass.toString());
-        foreach (const Class* desc, Util::descendantsList(&klass)) {
-            QString className = desc->toString();
-            
-            if (includedClasses.contains(className)) {
-                int index = classIndex[className];
-                if (indices.contains(index))
-                    continue;
-                indices << index;
-                
-                if (Util::isVirtualInheritancePath(desc, &klass)) {
-                    out << QString("        case %1: return (void*)dynamic_cast<%2*>((%3*)xptr);\n")
-                        .arg(index).arg(className).arg(klass.toString());
-                } else {
-                    out << QString("        case %1: return (void*)(%2*)(%3*)xptr;\n")
-                        .arg(index).arg(className).arg(klass.toString());
-                }
-            }
-        }
-        out << "        default: return xptr;\n";
-        out << "      }\n";
-    }
-    out << "    default: return xptr;\n";
-    out << "  }\n";
-    out << "}\n\n";
+    if (Options::castTable)
+        writeCastTable(out);
+    else
+        writeCastSwitch(out);
     
     // write out the inheritance list
     QHash<QVector<int>, int> inheritanceList;
@@ -296,6 +520,7 @@ void SmokeDataFile::write()
         inheritanceIndex[&klass] = idx;
     }
     out << "};\n\n";
+    checkIndexRange("inheritanceList", currentIdx);
 
     Class& globalSpace = classes["QGlobalSpace"];
 
@@ -344,9 +569,9 @@ void SmokeDataFile::write()
     
     // classes table
     out << "\n// List of all classes\n";
-    out << "// Name, external, index into inheritanceList, method dispatcher, enum dispatcher, class flags, size\n";
+    out << "// Name, external, index into inheritanceList, method dispatcher, enum dispatcher, class flags, size, alignment\n";
     out << "static Smoke::Class classes[] = {\n";
-    out << "    { 0L, false, 0, 0, 0, 0, 0 },\t// 0 (no class)\n";
+    out << "    { 0L, false, 0, 0, 0, 0, 0, 0 },\t// 0 (no class)\n";
     int classCount = 0;
     for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
         if (!iter.value())
@@ -355,10 +580,10 @@ void SmokeDataFile::write()
         Class* klass = &classes[iter.key()];
         
         if (externalClasses.contains(klass)) {
-            out << "    { \""  << iter.key() << "\", true, 0, 0, 0, 0, 0 },\t//" << iter.value() << "\n";
+            out << "    { "  << nameLiteral(iter.key()) << ", true, 0, 0, 0, 0, 0, 0 },\t//" << iter.value() << "\n";
         } else {
             QString smokeClassName = QString(iter.key()).replace("::", "__");
-            out << "    { \"" << iter.key() << "\", false" << ", "
+            out << "    { " << nameLiteral(iter.key()) << ", false" << ", "
                 << inheritanceIndex.value(klass, 0) << ", xcall_" << smokeClassName << ", "
                 << (enumClassesHandled.contains(iter.key()) ? QString("xenum_").append(smokeClassName) : "0") << ", ";
             QString flags = "0";
@@ -372,9 +597,9 @@ void SmokeDataFile::write()
             }
             out << flags << ", ";
             if (!klass->isNameSpace())
-                out << "sizeof(" << iter.key() << ")";
+                out << "sizeof(" << iter.key() << "), SMOKE_ALIGNOF(" << iter.key() << ")";
             else
-                out << '0';
+                out << "0, 0";
             out << " },\t//" << iter.value() << "\n";
         }
         classCount = iter.value();
@@ -393,6 +618,7 @@ void SmokeDataFile::write()
         }
     }
     
+    QStringList typeNames;
     int i = 1;
     for (QMap<QString, Type*>::const_iterator it = sortedTypes.constBegin(); it != sortedTypes.constEnd(); it++) {
         Type* t = it.value();
@@ -402,7 +628,8 @@ void SmokeDataFile::write()
         int classIdx = 0;
         QString flags = getTypeFlags(t, &classIdx);
         typeIndex[t] = i;
-        out << "    { \"" << it.key() << "\", " << classIdx << ", " << flags << " },\t//" << i++ << "\n";
+        typeNames << it.key();
+        out << "    { " << nameLiteral(it.key()) << ", " << classIdx << ", " << flags << " },\t//" << i++ << "\n";
     }
     out << "};\n\n";
 
@@ -513,33 +740,85 @@ void SmokeDataFile::write()
     
     out << "};\n\n";
     
-    out << "// Raw list of all methods, using munged names\n";
-    out << "static const char *methodNames[] = {\n";
-    out << "    \"\",\t//0\n";
+    checkIndexRange("argumentList", currentIdx);
+
     i = 1;
-    for (QMap<QString, int>::iterator it = methodNames.begin(); it != methodNames.end(); it++, i++) {
+    for (QMap<QString, int>::iterator it = methodNames.begin(); it != methodNames.end(); it++, i++)
         it.value() = i;
-        out << "    \"" << it.key() << "\",\t//" << i << "\n";
+
+    if (Options::stringTable) {
+        StringBlob blob;
+        QVector<int> classNameOffsets(classCount + 1, 0);
+        for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
+            if (iter.value())
+                classNameOffsets[iter.value()] = blob.add(iter.key());
+        }
+        QVector<int> typeNameOffsets(typeNames.count() + 1, 0);
+        for (int j = 0; j < typeNames.count(); j++)
+            typeNameOffsets[j + 1] = blob.add(typeNames[j]);
+        QVector<int> methodNameOffsets;
+        methodNameOffsets << blob.add("");
+        for (QMap<QString, int>::const_iterator it = methodNames.constBegin(); it != methodNames.constEnd(); it++)
+            methodNameOffsets << blob.add(it.key());
+
+        out << "// All class, type and method names, and their offsets in the blob (parallel to classes, types and methodNames)\n";
+        blob.write(out);
+        writeOffsetTable(out, "classNameOffsets", classNameOffsets);
+        writeOffsetTable(out, "typeNameOffsets", typeNameOffsets);
+        writeOffsetTable(out, "methodNameOffsets", methodNameOffsets);
+    } else {
+        out << "// Raw list of all methods, using munged names\n";
+        out << "static const char *methodNames[] = {\n";
+        out << "    \"\",\t//0\n";
+        for (QMap<QString, int>::const_iterator it = methodNames.constBegin(); it != methodNames.constEnd(); it++)
+            out << "    \"" << it.key() << "\",\t//" << it.value() << "\n";
+        out << "};\n\n";
     }
-    out << "};\n\n";
+
+    out << "// Hash tables for Smoke::idClass(), Smoke::idType() and Smoke::idMethodName()\n";
+    int classHashMask = writeHashTable(out, "classHash", classIndex.keys());
+    int typeHashMask = writeHashTable(out, "typeHash", typeNames);
+    int methodNameHashMask = writeHashTable(out, "methodNameHash", methodNames.keys());
     
-    out << "// (classId, name (index in methodNames), argumentList index, number of args, method flags, "
-        << "return type (index in types), xcall() index)\n";
-    out << "static Smoke::Method methods[] = {\n";
-    out << "    { 0, 0, 0, 0, 0, 0, 0 },\t// (no method)\n";
+    // with hot tables the methods table is only written as their columns
+    QString methodRows;
+    QTextStream methodsOut(&methodRows);
+    HotColumns hot;
+    methodsOut << "// (classId, name (index in methodNames), argumentList index, number of args, method flags, "
+        << "return type (index in types), xcall() index, signature (index in signatures))\n";
+    methodsOut << "static Smoke::Method methods[] = {\n";
+    methodsOut << "    { 0, 0, 0, 0, 0, 0, 0, 0 },\t// (no method)\n";
+    hot.addMethod(0, 0, 0, 0, "0", 0, 0, 0);
     
     i = 1;
     int methodCount = 1;
+    // direct entry points of the methods, generated next to the xcall functions
+    QStringList methodFns;
+    methodFns << "0";
+    // typed entry points of the methods with only scalar and enum types, and their distinct signatures
+    QStringList typedFns;
+    typedFns << "0";
+    QStringList typedFnDeclarations;
+    QStringList signatures;
+    QHash<QString, int> signatureIds;
+    // (classId, name) => entry of enumValues
+    QMap<QPair<int, int>, QString> enumValues;
+    // [first, last) of each class in methods and methodMaps
+    QHash<int, QPair<int, int> > methodRanges;
+    QHash<int, QPair<int, int> > methodMapRanges;
     for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
         Class* klass = &classes[iter.key()];
         const Method* destructor = 0;
         bool isExternal = false;
+        methodRanges[iter.value()] = qMakePair(i, i);
         if (externalClasses.contains(klass))
             isExternal = true;
         if (isExternal && !declaredVirtualMethods.contains(klass))
             continue;
         
         QList<const Method*> virtualMethods = Util::virtualMethodsForClass(klass);
+        QString methodFnPrefix = "xfn_" + QString(iter.key()).replace("::", "__") + '_';
+        QString typedFnPrefix = "xtfn_" + QString(iter.key()).replace("::", "__") + '_';
         
         int xcall_index = 1;
         foreach (const Method& meth, klass->methods()) {
@@ -551,13 +830,10 @@ void SmokeDataFile::write()
                 destructor = &meth;
                 continue;
             }
-            out << "    {" << iter.value() << ", " << methodNames[meth.name()] << ", ";
+            methodsOut << "    {" << iter.value() << ", " << methodNames[meth.name()] << ", ";
             int numArgs = meth.parameters().count();
-            if (numArgs) {
-                out << parameterIndices[&meth] << ", " << numArgs << ", ";
-            } else {
-                out << "0, 0, ";
-            }
+            int args = numArgs ? parameterIndices[&meth] : 0;
+            methodsOut << args << ", " << numArgs << ", ";
             QString flags = "0";
             if (meth.isConst())
                 flags += "|Smoke::mf_const";
@@ -591,30 +867,52 @@ void SmokeDataFile::write()
                 flags += "|Smoke::mf_slot";
 
             flags.replace("0|", "");
-            out << flags;
-            if (meth.type() == Type::Void) {
-                out << ", 0";
-            } else if (!typeIndex.contains(meth.type())) {
-                qFatal("missing type: %s in method %s (while writing out methods table)", qPrintable(meth.type()->toString()), qPrintable(meth.toString(false, true)));
+            methodsOut << flags;
+            int ret = 0;
+            if (meth.type() != Type::Void) {
+                if (!typeIndex.contains(meth.type()))
+                    qFatal("missing type: %s in method %s (while writing out methods table)", qPrintable(meth.type()->toString()), qPrintable(meth.toString(false, true)));
+                ret = typeIndex[meth.type()];
+            }
+            methodsOut << ", " << ret;
+            methodsOut << ", " << (isExternal ? 0 : xcall_index);
+
+            // typed entry point, if the method only takes and returns scalars and enums
+            QString returnType;
+            QStringList paramTypes;
+            QString signature = isExternal ? QString() : Util::typedSignature(meth, &returnType, &paramTypes);
+            int signatureIndex = 0;
+            if (signature.isEmpty()) {
+                typedFns << "0";
             } else {
-                out << ", " << typeIndex[meth.type()];
+                if (!signatureIds.contains(signature)) {
+                    signatures << signature;
+                    signatureIds[signature] = signatures.count();
+                }
+                signatureIndex = signatureIds[signature];
+                QString name = typedFnPrefix + QString::number(xcall_index);
+                typedFnDeclarations << returnType + ' ' + name + '(' + paramTypes.join(", ") + ");";
+                typedFns << "(Smoke::TypedFn)" + name;
             }
-            out << ", " << (isExternal ? 0 : xcall_index) << "},";
+            methodsOut << ", " << signatureIndex << "},";
+            hot.addMethod(iter.value(), methodNames[meth.name()], args, numArgs, flags, ret, isExternal ? 0 : xcall_index,
+                          signatureIndex);
             
             // comment
-            out << "\t//" << i << " " << klass->toString() << "::";
-            out << meth.name() << '(';
+            methodsOut << "\t//" << i << " " << klass->toString() << "::";
+            methodsOut << meth.name() << '(';
             for (int j = 0; j < meth.parameters().count(); j++) {
-                if (j > 0) out << ", ";
-                out << meth.parameters()[j].toString();
+                if (j > 0) methodsOut << ", ";
+                methodsOut << meth.parameters()[j].toString();
             }
-            out << ')';
+            methodsOut << ')';
             if (meth.isConst())
-                out << " const";
+                methodsOut << " const";
             if (meth.flags() & Method::PureVirtual)
-                out << " [pure virtual]";
-            out << "\n";
+                methodsOut << " [pure virtual]";
+            methodsOut << "\n";
             methodIdx[&meth] = i;
+            methodFns << (isExternal ? "0" : methodFnPrefix + QString::number(xcall_index));
             xcall_index++;
             i++;
             methodCount++;
@@ -643,15 +941,30 @@ void SmokeDataFile::write()
                     index = *typeIt;
                 }
 
+                // the values of public enums are put into enumValues, protected ones are only accessible in x_Foo
+                bool inTable = !isExternal && e->access() == Access_public;
+                QString scope = e->parent() ? klass->toString() : e->nameSpace();
+                if (!scope.isEmpty())
+                    scope += "::";
+
                 foreach (const EnumMember& member, e->members()) {
-                    out << "    {" << iter.value() << ", " << methodNames[member.name()]
+                    methodsOut << "    {" << iter.value() << ", " << methodNames[member.name()]
                         << ", 0, 0, Smoke::mf_static|Smoke::mf_enum, " << index
-                        << ", " << xcall_index << "},";
+                        << ", " << xcall_index << ", 0},";
+                    hot.addMethod(iter.value(), methodNames[member.name()], 0, 0, "Smoke::mf_static|Smoke::mf_enum", index,
+                                  xcall_index, 0);
                     
                     // comment
-                    out << "\t//" << i << " " << klass->toString() << "::" << member.name() << " (enum)";
-                    out << "\n";
+                    methodsOut << "\t//" << i << " " << klass->toString() << "::" << member.name() << " (enum)";
+                    methodsOut << "\n";
                     methodIdx[&member] = i;
+                    methodFns << ((isExternal || inTable) ? "0" : methodFnPrefix + QString::number(xcall_index));
+                    typedFns << "0";
+                    if (inTable) {
+                        enumValues[qMakePair(iter.value(), methodNames[member.name()])] =
+                            QString("{%1, %2, %3, (long)%4%5}").arg(iter.value()).arg(methodNames[member.name()])
+                                                              .arg(index).arg(scope).arg(member.name());
+                    }
                     xcall_index++;
                     i++;
                     methodCount++;
@@ -659,19 +972,126 @@ void SmokeDataFile::write()
             }
         }
         if (destructor) {
-            out << "    {" << iter.value() << ", " << methodNames[destructor->name()] << ", 0, 0, Smoke::mf_dtor";
+            QString flags = "Smoke::mf_dtor";
             if (destructor->access() == Access_private)
-                out << "|Smoke::mf_protected";
-            out << ", 0, " << xcall_index << " },\t//" << i << " " << klass->toString()
+                flags += "|Smoke::mf_protected";
+            methodsOut << "    {" << iter.value() << ", " << methodNames[destructor->name()] << ", 0, 0, " << flags;
+            methodsOut << ", 0, " << xcall_index << ", 0 },\t//" << i << " " << klass->toString()
                 << "::" << destructor->name() << "()\n";
+            hot.addMethod(iter.value(), methodNames[destructor->name()], 0, 0, flags, 0, xcall_index, 0);
             methodIdx[destructor] = i;
+            methodFns << ((isExternal || !Util::hasClassPublicDestructor(klass)) ? "0" : methodFnPrefix + QString::number(xcall_index));
+            typedFns << "0";
             xcall_index++;
             i++;
             methodCount++;
         }
+        methodRanges[iter.value()].second = i;
     }
     
+    methodsOut << "};\n\n";
+    methodsOut.flush();
+    if (!Options::hotColdTables)
+        out << methodRows;
+
+    out << "// Direct entry points of the methods, defined in the x_*.cpp files. Parallel to the methods table.\n";
+    foreach (const QString& fn, methodFns) {
+        if (fn != "0")
+            out << "void " << fn << "(void*, Smoke::Stack);\n";
+    }
+    out << "\nstatic Smoke::MethodFn methodFns[] = {\n";
+    for (int j = 0; j < methodFns.count(); j++) {
+        out << "    " << methodFns[j] << ",\t//" << j << "\n";
+    }
+    out << "};\n\n";
+
+    out << "// Typed entry points, defined in the x_*.cpp files. Parallel to the methods table.\n";
+    foreach (const QString& decl, typedFnDeclarations)
+        out << decl << "\n";
+    out << "\nstatic Smoke::TypedFn typedFns[] = {\n";
+    for (int j = 0; j < typedFns.count(); j++) {
+        out << "    " << typedFns[j] << ",\t//" << j << "\n";
+    }
+    out << "};\n\n";
+
+    out << "// Native signatures of the typed entry points\n";
+    out << "static const char *signatures[] = {\n";
+    out << "    \"\",\t//0\n";
+    for (int j = 0; j < signatures.count(); j++) {
+        out << "    \"" << signatures[j] << "\",\t//" << j + 1 << "\n";
+    }
+    out << "};\n\n";
+
+    if (Options::hotColdTables) {
+        out << "// The methods table, one array per field of Smoke::Method\n";
+        writeColumn(out, "Smoke::Index", "methodClassIds", hot.methodClassIds);
+        writeColumn(out, "Smoke::Index", "methodNameIds", hot.methodNameIds);
+        writeColumn(out, "Smoke::Index", "methodArgs", hot.methodArgs);
+        writeColumn(out, "unsigned char", "methodNumArgs", hot.methodNumArgs);
+        writeColumn(out, "unsigned short", "methodFlags", hot.methodFlags);
+        writeColumn(out, "Smoke::Index", "methodReturnTypes", hot.methodReturnTypes);
+        writeColumn(out, "Smoke::Index", "methodCallIndices", hot.methodCallIndices);
+        writeColumn(out, "Smoke::Index", "methodSignatures", hot.methodSignatures);
+        out << "static const Smoke::HotTables hotTables = {\n"
+            << "    methodClassIds, methodNameIds, methodArgs, methodNumArgs, methodFlags, methodReturnTypes,\n"
+            << "    methodCallIndices, methodSignatures\n"
+            << "};\n\n";
+    }
+    checkIndexRange("signatures", signatures.count() + 1);
+
+    out << "// Values of the public enum members, sorted by class and name (classId, name (index in methodNames), "
+        << "type (index in types), value)\n";
+    out << "static Smoke::EnumValue enumValues[] = {\n";
+    out << "    {0, 0, 0, 0},\t//0 (no enum value)\n";
+    int enumValueCount = 1;
+    for (QMap<QPair<int, int>, QString>::const_iterator it = enumValues.constBegin(); it != enumValues.constEnd(); it++) {
+        out << "    " << it.value() << ",\t//" << enumValueCount++ << "\n";
+    }
+    out << "};\n\n";
+    checkIndexRange("enumValues", enumValueCount);
+
+    out << "// Public fields, sorted by class and name (classId, name (index in methodNames), type (index in types), "
+        << "flags, offset, address if static)\n";
+    out << "static Smoke::Field fields[] = {\n";
+    out << "    {0, 0, 0, 0, 0, 0},\t//0 (no field)\n";
+    int fieldCount = 1;
+    for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
+        Class* klass = &classes[iter.key()];
+        if (externalClasses.contains(klass))
+            continue;
+        // the getters have the names of the fields
+        QMap<int, QPair<QString, QString> > classFields;
+        foreach (const Method& meth, klass->methods()) {
+            const Field* field = Util::fieldAccessors.value(&meth);
+            if (!field || !meth.parameters().isEmpty() || field->access() != Access_public)
+                continue;
+            // bit-fields and references can't be addressed, static constants might not be defined anywhere
+            if ((field->flags() & Field::BitField) || field->type()->isRef()
+                || ((field->flags() & Field::Static) && field->type()->isConst()))
+                continue;
+            if (!typeIndex.contains(meth.type()))
+                continue;
+            // offsetof() is only defined for standard-layout classes; a template argument list with a comma would
+            // be split up by the macro
+            bool isStatic = field->flags() & Field::Static;
+            if (!isStatic && (!Util::isStandardLayout(klass) || iter.key().contains(',')))
+                continue;
+            const Type* type = field->type();
+            bool readOnly = type->pointerDepth() ? type->isConstPointer(type->pointerDepth() - 1) : type->isConst();
+            QString entry = QString("{%1, %2, %3, %4, ").arg(iter.value()).arg(methodNames[meth.name()]).arg(typeIndex[meth.type()])
+                                                      .arg(readOnly ? "Smoke::ff_readOnly" : "0");
+            if (isStatic)
+                entry += QString("0, (void*)&%1::%2}").arg(iter.key()).arg(field->name());
+            else
+                entry += QString("offsetof(%1, %2), 0}").arg(iter.key()).arg(field->name());
+            classFields[methodNames[meth.name()]] = qMakePair(entry, field->name());
+        }
+        for (QMap<int, QPair<QString, QString> >::const_iterator it = classFields.constBegin(); it != classFields.constEnd(); it++) {
+            out << "    " << it.value().first << ",\t//" << fieldCount++ << " " << iter.key() << "::" << it.value().second << "\n";
+        }
+    }
     out << "};\n\n";
+    checkIndexRange("fields", fieldCount);
 
     out << "static Smoke::Index ambiguousMethodList[] = {\n";
     out << "    0,\n";
@@ -714,6 +1134,7 @@ void SmokeDataFile::write()
     }
 
     out << "};\n\n";
+    checkIndexRange("ambiguousMethodList", i);
 
     int methodMapCount = 1;
     out << "// Class ID, munged name ID (index into methodNames), method def (see methods) if >0 or number of overloads if <0\n";
@@ -722,6 +1143,7 @@ void SmokeDataFile::write()
 
     for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
         Class* klass = &classes[iter.key()];
+        methodMapRanges[iter.value()] = qMakePair(methodMapCount, methodMapCount);
         if (externalClasses.contains(klass))
             continue;
         
@@ -744,10 +1166,21 @@ void SmokeDataFile::write()
             out << "\n";
             methodMapCount++;
         }
+        methodMapRanges[iter.value()].second = methodMapCount;
     }
 
     out << "};\n\n";
 
+    out << "// [first, last) of each class in methods and methodMaps\n";
+    out << "static Smoke::ClassRange classRanges[] = {\n";
+    out << "    {0, 0, 0, 0},\t//0 (no class)\n";
+    for (QMap<QString, int>::const_iterator iter = classIndex.constBegin(); iter != classIndex.constEnd(); iter++) {
+        out << "    {" << methodRanges[iter.value()].first << ", " << methodRanges[iter.value()].second << ", "
+            << methodMapRanges[iter.value()].first << ", " << methodMapRanges[iter.value()].second << "},"
+            << "\t//" << iter.value() << " " << iter.key() << "\n";
+    }
+    out << "};\n\n";
+
     out << "}\n\n";
 
     out << "extern \"C\" {\n\n";
@@ -758,6 +1191,12 @@ void SmokeDataFile::write()
             out << "\n";
     }
 
+    checkIndexRange("classes", classCount + 1);
+    checkIndexRange("methods", methodCount);
+    checkIndexRange("methodMaps", methodMapCount);
+    checkIndexRange("methodNames", methodNames.count() + 1);
+    checkIndexRange("types", typeIndex.count() + 1);
+
     out << "static bool initialized = false;\n";
     out << "Smoke *" << Options::module << "_Smoke = 0;\n\n";
     out << "// Create the Smoke instance encapsulating all the above.\n";
@@ -769,14 +1208,45 @@ void SmokeDataFile::write()
     out << "    " << Options::module << "_Smoke = new Smoke(\n";
     out << "        \"" << Options::module << "\",\n";
     out << "        " << smokeNamespaceName << "::classes, " << classCount << ",\n";
-    out << "        " << smokeNamespaceName << "::methods, " << methodCount << ",\n";
+    if (Options::hotColdTables)
+        out << "        0, " << methodCount << ",\n";
+    else
+        out << "        " << smokeNamespaceName << "::methods, " << methodCount << ",\n";
     out << "        " << smokeNamespaceName << "::methodMaps, " << methodMapCount << ",\n";
-    out << "        " << smokeNamespaceName << "::methodNames, " << methodNames.count() << ",\n";
+    if (Options::stringTable)
+        out << "        0, " << methodNames.count() << ",\n";
+    else
+        out << "        " << smokeNamespaceName << "::methodNames, " << methodNames.count() << ",\n";
     out << "        " << smokeNamespaceName << "::types, " << typeIndex.count() << ",\n";
     out << "        " << smokeNamespaceName << "::inheritanceList,\n";
     out << "        " << smokeNamespaceName << "::argumentList,\n";
     out << "        " << smokeNamespaceName << "::ambiguousMethodList,\n";
-    out << "        " << smokeNamespaceName << "::cast );\n";
+    if (Options::stringTable) {
+        out << "        " << smokeNamespaceName << "::cast,\n";
+        out << "        " << smokeNamespaceName << "::strings,\n";
+        out << "        " << smokeNamespaceName << "::classNameOffsets,\n";
+        out << "        " << smokeNamespaceName << "::typeNameOffsets,\n";
+        out << "        " << smokeNamespaceName << "::methodNameOffsets );\n";
+    } else {
+        out << "        " << smokeNamespaceName << "::cast );\n";
+    }
+    out << "    " << Options::module << "_Smoke->classHash = " << smokeNamespaceName << "::classHash;\n";
+    out << "    " << Options::module << "_Smoke->classHashMask = " << classHashMask << ";\n";
+    out << "    " << Options::module << "_Smoke->typeHash = " << smokeNamespaceName << "::typeHash;\n";
+    out << "    " << Options::module << "_Smoke->typeHashMask = " << typeHashMask << ";\n";
+    out << "    " << Options::module << "_Smoke->methodNameHash = " << smokeNamespaceName << "::methodNameHash;\n";
+    out << "    " << Options::module << "_Smoke->methodNameHashMask = " << methodNameHashMask << ";\n";
+    out << "    " << Options::module << "_Smoke->methodFns = " << smokeNamespaceName << "::methodFns;\n";
+    out << "    " << Options::module << "_Smoke->typedFns = " << smokeNamespaceName << "::typedFns;\n";
+    out << "    " << Options::module << "_Smoke->signatures = " << smokeNamespaceName << "::signatures;\n";
+    out << "    " << Options::module << "_Smoke->numSignatures = " << signatures.count() + 1 << ";\n";
+    out << "    " << Options::module << "_Smoke->classRanges = " << smokeNamespaceName << "::classRanges;\n";
+    if (Options::hotColdTables)
+        out << "    " << Options::module << "_Smoke->hotTables = &" << smokeNamespaceName << "::hotTables;\n";
+    out << "    " << Options::module << "_Smoke->enumValues = " << smokeNamespaceName << "::enumValues;\n";
+    out << "    " << Options::module << "_Smoke->numEnumValues = " << enumValueCount << ";\n";
+    out << "    " << Options::module << "_Smoke->fields = " << smokeNamespaceName << "::fields;\n";
+    out << "    " << Options::module << "_Smoke->numFields = " << fieldCount << ";\n";
     out << "    initialized = true;\n";
     out << "}\n\n";
     out << "void delete_" << Options::module << "_Smoke() { delete " << Options::module << "_Smoke; }\n\n";
@@ -547,6 +547,7 @@ void GeneratorVisitor::visitDeclarator(DeclaratorAST* node)
     if (!inMethod && !klass.isEmpty() && inClass) {
         Field field = Field(klass.top(), declName, currentTypeRef, access.top());
         if (isStatic) field.setFlag(Field::Static);
+        if (node->bit_expression) field.setFlag(Field::BitField);
         klass.top()->appendField(field);
         return;
     } else if (!inMethod && !inClass) {
@@ -3,8 +3,9 @@
 
 #include <cstddef>
 #include <cstring>
-#include <string>
-#include <map>
+#include <typeinfo>
+
+#include <smoke_config.h>
 
 /*
    Copyright (C) 2002, Ashley Winters <qaqortog@nwlink.com>
@@ -39,7 +40,7 @@
 */
 
 #ifdef WIN32
-  // Define this when building a smoke lib that doesn't have any parents - else Smoke::classMap is not exported.
+  // Define this when building a smoke lib that doesn't have any parents - else the class registry is not exported.
   #ifdef BASE_SMOKE_BUILDING
     #define BASE_SMOKE_EXPORT __declspec(dllexport)
   #else
@@ -63,11 +64,38 @@
   #define SMOKE_IMPORT
 #endif
 
+#ifdef _MSC_VER
+  #define SMOKE_ALIGNOF(T) __alignof(T)
+#else
+  #define SMOKE_ALIGNOF(T) __alignof__(T)
+#endif
+
+// std::underlying_type for Smoke::EnumTypeFlags, when the compiler has it
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1700)
+  #include <type_traits>
+  #define SMOKE_HAVE_UNDERLYING_TYPE
+#endif
+
+// Modules reference the tag matching the Smoke::Index width they were compiled with, so they can't be linked
+// against a smokebase built with a different width.
+#ifdef SMOKE_32BIT_INDEX
+  #define SMOKE_INDEX_ABI_TAG smoke_index_abi_32
+#else
+  #define SMOKE_INDEX_ABI_TAG smoke_index_abi_16
+#endif
+extern "C" BASE_SMOKE_EXPORT const int SMOKE_INDEX_ABI_TAG;
+
 class SmokeBinding;
 
 class BASE_SMOKE_EXPORT Smoke {
 private:
     const char *module_name;
+    unsigned int module_id;
+
+    // Assigns the module id and adds the classes defined by this module to the global class registry used by
+    // findClass(). Aborts if the module was compiled with another Smoke::Index width than smokebase. If all
+    // module ids are taken, the module id stays 0.
+    void registerClasses(int indexSize, int abiTag);
 
 public:
     union StackItem; // defined below
@@ -83,10 +111,39 @@ public:
 	EnumToLong
     };
 
+    /**
+     * Calling conventions a binding can opt into, see callingConvention.
+     */
+    enum CallingConvention {
+	cc_returnInPlace = 0x01,	// classes of smoke modules returned by value are constructed into storage passed in x[0].s_voidp
+	cc_constructInPlace = 0x02	// constructors construct into storage passed in x[0].s_voidp, if it isn't 0
+    };
+
+    /**
+     * Special method indices understood by the classFn of classes that can
+     * be instantiated, besides 0 which sets the SmokeBinding of an instance.
+     */
+    enum SpecialMethod {
+	SetOverriddenMethod = -1,	// see setMethodOverridden()
+	InstanceLayout = -2,		// see instanceLayout()
+	DestroyInPlace = -3,		// see destroyInPlace()
+	SetDeletedNotification = -4	// see setDeletedNotification()
+    };
+
+#ifdef SMOKE_32BIT_INDEX
+    typedef int Index;
+#else
     typedef short Index;
+#endif
     typedef void (*ClassFn)(Index method, void* obj, Stack args);
     typedef void* (*CastFn)(void* obj, Index from, Index to);
     typedef void (*EnumFn)(EnumOperation, Index, void*&, long&);
+    typedef void (*MethodFn)(void* obj, Stack args);
+    /**
+     * A typed entry point, cast to the real prototype given by its signature
+     * before calling it.
+     */
+    typedef void (*TypedFn)();
 
     /**
      * Describe one index in a given module.
@@ -109,9 +166,19 @@ public:
      * A ModuleIndex with both fields set to 0.
      */
     static ModuleIndex NullModuleIndex; 
-    
-    typedef std::map<std::string, ModuleIndex> ClassMap;
-    static ClassMap classMap;
+
+    /**
+     * A ModuleIndex packed into 32 bits, for bindings that store many of
+     * them: the moduleId() in the high 8 bits and the index in the low 24
+     * bits. NullModuleIndex is 0. Convert with toGlobalIndex() and
+     * fromGlobalIndex().
+     */
+    typedef unsigned int GlobalIndex;
+    enum {
+        GlobalIndexBits = 24,
+        GlobalIndexMask = (1 << GlobalIndexBits) - 1,
+        MaxModules = 255
+    };
 
     enum ClassFlags {
         cf_constructor = 0x01,  // has a constructor
@@ -131,6 +198,7 @@ public:
 	EnumFn enumFn;		// Handles enum pointers
         unsigned short flags;   // ClassFlags
         unsigned int size;
+        unsigned int alignment; // of the class, for storage of Class::size bytes
     };
 
     enum MethodFlags {
@@ -161,6 +229,7 @@ public:
 	unsigned short flags;	// MethodFlags (const/static/etc...)
 	Index ret;		// Index into types for the return type
 	Index method;		// Passed to Class.classFn, to call method
+	Index signature;	// Index into signatures, 0 if there is no typed entry point
     };
 
     /**
@@ -180,6 +249,73 @@ public:
 	Index method;		// Index into methods
     };
 
+    /**
+     * The value of a public enum member. The methods table has an mf_enum
+     * entry for each of them as well, but reading the value from here
+     * doesn't need a call.
+     */
+    struct EnumValue {
+	Index classId;		// Index into classes
+	Index name;		// Index into methodNames
+	Index type;		// Index into types
+	long value;
+    };
+
+    enum FieldFlags {
+	ff_readOnly = 0x01	// const field, don't write it
+    };
+
+    /**
+     * The location of a public field. The methods table has accessor methods
+     * for all fields, this allows reading and writing them in place.
+     */
+    struct Field {
+	Index classId;		// Index into classes
+	Index name;		// Index into methodNames, the name of the getter
+	Index type;		// Index into types, the return type of the getter
+	unsigned short flags;	// FieldFlags
+	std::ptrdiff_t offset;	// Offset into an instance of the class, for non-static fields
+	void *address;		// Address of static fields, 0 otherwise
+    };
+
+    /**
+     * The entries of a class in methods and methodMaps, as [first, last)
+     * ranges. Both tables are sorted by classId, so these are contiguous.
+     */
+    struct ClassRange {
+	Index firstMethod;	// Index into methods
+	Index lastMethod;	// One past the last method of the class
+	Index firstMethodMap;	// Index into methodMaps
+	Index lastMethodMap;	// One past the last method map of the class
+    };
+
+    /**
+     * The methods table of a module generated with -hc, as one dense array
+     * per field instead of an array of Method. Lookups only read the
+     * columns they need, e.g. the names in a class range, and the others
+     * stay paged out. Such a module has no methods array; use the accessors
+     * like methodClassId() or methodArgs(), which read whichever of the two
+     * a module has.
+     */
+    struct HotTables {
+	const Index *methodClassIds;	// Method::classId
+	const Index *methodNameIds;	// Method::name
+	const Index *methodArgs;	// Method::args
+	const unsigned char *methodNumArgs;	// Method::numArgs
+	const unsigned short *methodFlags;	// Method::flags
+	const Index *methodReturnTypes;	// Method::ret
+	const Index *methodCallIndices;	// Method::method
+	const Index *methodSignatures;	// Method::signature
+    };
+
+    /**
+     * One entry of a generated cast table, see tableCast().
+     */
+    struct CastEntry {
+	Index to;		// Index into classes
+	void *(*thunk)(void *);	// Does the cast
+    };
+
     enum TypeFlags {
         // The first 4 bits indicate the TypeId value, i.e. which field
         // of the StackItem union is used.
@@ -190,8 +326,67 @@ public:
 	tf_ptr = 0x20,   	// Pointer, 'type*'
 	tf_ref = 0x30,   	// Reference, 'type&'
 	// Can | whatever ones of these apply
-	tf_const = 0x40		// const argument
+	tf_const = 0x40,	// const argument
+	// For enums, see EnumTypeFlags. Only valid if tf_enumInfo is set.
+	// Note that these are set in the flags of enum types of modules
+	// generated since they were added, so compare flags of enum types
+	// with the tf_enumMask bits cleared.
+	tf_enumInfo = 0x80,	// size and signedness are known
+	tf_enumSize = 0x300,	// log2 of sizeof(enum)
+	tf_enumSigned = 0x400,	// values are sign extended
+	tf_enumMask = tf_enumInfo | tf_enumSize | tf_enumSigned
+    };
+
+    /**
+     * Whether the underlying type of the enum type T is signed.
+     */
+    template<typename T>
+    struct EnumIsSigned {
+#ifdef SMOKE_HAVE_UNDERLYING_TYPE
+	enum { value = std::is_signed<typename std::underlying_type<T>::type>::value };
+#else
+	// without C++11, enums are unscoped: this checks the promoted type,
+	// which agrees with the underlying type for all values of the enum
+	enum { value = (T)0 - 1 < 0 };
+#endif
+    };
+
+    /**
+     * The tf_enum* flags of the enum type T, computed by the compiler.
+     */
+    template<typename T>
+    struct EnumTypeFlags {
+	enum { value = tf_enumInfo
+		       | (sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 0x100 : sizeof(T) == 4 ? 0x200 : 0x300)
+		       | (EnumIsSigned<T>::value ? tf_enumSigned : 0) };
     };
+
+    /**
+     * Reads an enum value stored in place, e.g. in the storage of a binding,
+     * as described by the flags of its type (which need tf_enumInfo). This
+     * replaces EnumNew/EnumFromLong/EnumToLong/EnumDelete of the enumFn.
+     */
+    static inline long readEnum(const void *ptr, unsigned short flags) {
+	bool isSigned = (flags & tf_enumSigned) != 0;
+	switch ((flags & tf_enumSize) >> 8) {
+	case 0: return isSigned ? (long)*(const signed char*)ptr : (long)*(const unsigned char*)ptr;
+	case 1: return isSigned ? (long)*(const short*)ptr : (long)*(const unsigned short*)ptr;
+	case 2: return isSigned ? (long)*(const int*)ptr : (long)*(const unsigned int*)ptr;
+	default: return *(const long*)ptr;
+	}
+    }
+
+    /**
+     * Stores an enum value in place, see readEnum().
+     */
+    static inline void writeEnum(void *ptr, unsigned short flags, long value) {
+	switch ((flags & tf_enumSize) >> 8) {
+	case 0: *(unsigned char*)ptr = (unsigned char)value; break;
+	case 1: *(unsigned short*)ptr = (unsigned short)value; break;
+	case 2: *(unsigned int*)ptr = (unsigned int)value; break;
+	default: *(long*)ptr = value; break;
+	}
+    }
     /**
      * One Type entry is one argument type needed by a method.
      * Type entries are shared, there is only one entry for "int" etc.
@@ -246,7 +441,8 @@ public:
     Index numClasses;
 
     /**
-     * The methods array defines every method in every class for this module
+     * The methods array defines every method in every class for this module.
+     * It is 0 for modules generated with -hc, see hotTables.
      */
     Method *methods;
     Index numMethods;
@@ -290,6 +486,115 @@ public:
      */
     CastFn castFn;
 
+    /**
+     * Optional hash tables for idClass(), idType() and idMethodName(), set up
+     * by the generated init function after construction.
+     * Each slot holds an index into classes, types or methodNames, 0 marks an
+     * empty slot. Slots are addressed with hashString() & mask and collisions
+     * are resolved by linear probing, so the table size is a power of two and
+     * the mask is size - 1. If a table is 0, the binary search is used.
+     */
+    const Index *classHash;
+    unsigned int classHashMask;
+    const Index *typeHash;
+    unsigned int typeHashMask;
+    const Index *methodNameHash;
+    unsigned int methodNameHashMask;
+
+    /**
+     * Optional table parallel to methods, set up by the generated init
+     * function. methodFns[i] calls methods[i] directly, without going
+     * through the classFn of the class. Entries are 0 for methods that
+     * can't be called, e.g. those of external classes.
+     */
+    MethodFn *methodFns;
+
+    /**
+     * Optional table parallel to methods, set up by the generated init
+     * function. Public non-virtual methods that only take and return scalars
+     * and enums get an entry point with a native prototype, e.g.
+     * int (*)(void *obj) for int Foo::width() const. methodSignature() is
+     * the index of the prototype in signatures, e.g. "int (void*)"; the
+     * types are bool, signed and unsigned char, short, int and long, float
+     * and double, with enums passed as long. Non-static methods take the
+     * object (cast to the method's class) first. Methods with the same
+     * signature in one module have the same signature index.
+     */
+    TypedFn *typedFns;
+    const char **signatures;
+    Index numSignatures;
+
+    /**
+     * Optional table parallel to classes, set up by the generated init
+     * function. Use classRange() to access it.
+     */
+    ClassRange *classRanges;
+
+    /**
+     * Optional, set up by the generated init function of modules generated
+     * with -hc. These modules store the methods table only as these
+     * columns, methods is 0.
+     */
+    const HotTables *hotTables;
+
+    /**
+     * CallingConvention flags, 0 by default. Set them once after loading the
+     * module, before calling any method.
+     * With cc_returnInPlace, methods returning a class by value, where the
+     * return type (see Method::ret) is a t_class with a classId, take a
+     * buffer for the returned object in x[0].s_voidp. The buffer has to be
+     * Class::size bytes and aligned to Class::alignment, taken from the
+     * module defining the class: for external classes, size and alignment
+     * are 0 in this module, so look the class up with findClass() first.
+     * The method constructs its return value there and returns the same
+     * pointer in x[0].s_class; the value has to be destroyed with
+     * destroyInPlace(), passing returnedValue = true. Other values, e.g. of template types or types
+     * mapped to t_voidp, are always copied to the heap.
+     * With cc_constructInPlace, constructors construct the instance into the
+     * buffer passed in x[0].s_voidp, sized and aligned as told by
+     * instanceLayout(), or on the heap if x[0].s_voidp is 0. Destroy those
+     * instances with destroyInPlace() as well.
+     */
+    unsigned int callingConvention;
+
+    /**
+     * Optional table of the values of all public enum members, sorted by
+     * classId and name, set up by the generated init function. Entry 0 is
+     * empty, like in the other tables.
+     */
+    EnumValue *enumValues;
+    Index numEnumValues;
+
+    /**
+     * Optional table of the public fields, sorted by classId and name, set
+     * up by the generated init function. Bit-fields, references and static
+     * constants aren't in it, nor are non-static fields of classes that
+     * aren't standard-layout, as offsetof() can't be used for them. Entry 0
+     * is empty.
+     */
+    Field *fields;
+    Index numFields;
+
+    /**
+     * Optional string table, passed to the constructor by modules generated
+     * with -sb. All names are then stored in the single strings blob, and
+     * classNameOffsets, typeNameOffsets and methodNameOffsets (parallel to
+     * classes, types and methodNames) hold their offsets in it. Offset 0 is
+     * a null name. Class::className, Type::name and methodNames are 0 in
+     * that case, so the tables don't need relocations at load time; use
+     * className(), typeName() and methodName() to access the names.
+     */
+    const char *strings;
+    const unsigned int *classNameOffsets;
+    const unsigned int *typeNameOffsets;
+    const unsigned int *methodNameOffsets;
+
+    /**
+     * Runtime data kept by smokebase for this module, e.g. lookup caches.
+     */
+    struct Private;
+    Private *d;
+
     /**
      * Constructor
      */
@@ -302,8 +607,13 @@ public:
 	  Index *_inheritanceList,
 	  Index *_argumentList,
 	  Index *_ambiguousMethodList,
-	  CastFn _castFn) :
+	  CastFn _castFn,
+	  const char *_strings = 0,
+	  const unsigned int *_classNameOffsets = 0,
+	  const unsigned int *_typeNameOffsets = 0,
+	  const unsigned int *_methodNameOffsets = 0) :
 		module_name(_moduleName),
+		module_id(0),
 		classes(_classes), numClasses(_numClasses),
 		methods(_methods), numMethods(_numMethods),
 		methodMaps(_methodMaps), numMethodMaps(_numMethodMaps),
@@ -312,15 +622,55 @@ public:
 		inheritanceList(_inheritanceList),
 		argumentList(_argumentList),
 		ambiguousMethodList(_ambiguousMethodList),
-		castFn(_castFn)
+		castFn(_castFn),
+		classHash(0), classHashMask(0),
+		typeHash(0), typeHashMask(0),
+		methodNameHash(0), methodNameHashMask(0),
+		methodFns(0),
+		typedFns(0), signatures(0), numSignatures(0),
+		classRanges(0),
+		hotTables(0),
+		callingConvention(0),
+		enumValues(0), numEnumValues(0),
+		fields(0), numFields(0),
+		strings(_strings),
+		classNameOffsets(_classNameOffsets),
+		typeNameOffsets(_typeNameOffsets),
+		methodNameOffsets(_methodNameOffsets),
+		d(0)
         {
-            for (Index i = 1; i <= numClasses; ++i) {
-                if (!classes[i].external) {
-                    classMap[className(i)] = ModuleIndex(this, i);
-                }
-            }
+            registerClasses(sizeof(Index), SMOKE_INDEX_ABI_TAG);
         }
 
+    /**
+     * Removes the classes of this module from the class registry.
+     */
+    ~Smoke();
+
+    /**
+     * Writes the metadata of this module to a binary image: the classes,
+     * methods, methodMaps, types, the inheritance, argument and ambiguous
+     * method lists, the class ranges (computed if the module has no
+     * classRanges table), enumValues and all names. Returns false if
+     * the file couldn't be written.
+     */
+    bool writeImage(const char *path);
+
+    /**
+     * Maps an image written by writeImage() and wraps it in a Smoke instance,
+     * without loading the library of the module. Returns 0 if the image was
+     * written by another version of smokebase or on a platform with another
+     * Smoke::Index width, struct layout or byte order.
+     * The module has no code: classFn, enumFn and castFn are 0, so it can be
+     * used for lookups and introspection, but not for calls. Like a library,
+     * it's added to the class registry, so the parent modules have to be
+     * loaded first and the library of the same module must not be loaded at
+     * the same time. Damaged images are rejected as well. The image stays
+     * mapped after the instance is deleted, like the class registry entries
+     * that point into it, since other threads might still be reading them.
+     */
+    static Smoke *loadImage(const char *path);
+
     /**
      * Returns the name of the module (e.g. "qt" or "kde")
      */
@@ -328,27 +678,286 @@ public:
 	return module_name;
     }
 
-    inline void *cast(void *ptr, const ModuleIndex& from, const ModuleIndex& to) {
-        if (castFn == 0) {
-            return ptr;
-        }
-        
-        if (from.smoke == to.smoke) {
-            return (*castFn)(ptr, from.index, to.index);
-        }
-        
-        const Smoke::Class &klass = to.smoke->classes[to.index];
-        return (*castFn)(ptr, from.index, idClass(klass.className, true).index);
+    /**
+     * Returns the id of the module used in GlobalIndex, between 1 and
+     * MaxModules. The ids of deleted modules are reused. If MaxModules
+     * modules were loaded already when this one was, it has no id and 0 is
+     * returned; toGlobalIndex() then returns 0 for its entries.
+     */
+    inline unsigned int moduleId() const {
+	return module_id;
     }
-    
+
+    /**
+     * Returns the loaded module with the given id, or 0.
+     */
+    static Smoke *moduleForId(unsigned int id);
+
+    static inline GlobalIndex toGlobalIndex(const ModuleIndex& mi) {
+        if (!mi.smoke || !mi.smoke->module_id)
+            return 0;
+        return (mi.smoke->module_id << GlobalIndexBits) | ((unsigned int) mi.index & GlobalIndexMask);
+    }
+
+    /**
+     * Returns NullModuleIndex for 0 and for indices of a module that is no
+     * longer loaded.
+     */
+    static inline ModuleIndex fromGlobalIndex(GlobalIndex gi) {
+        Smoke *smoke = gi ? moduleForId(gi >> GlobalIndexBits) : 0;
+        if (!smoke)
+            return NullModuleIndex;
+        return ModuleIndex(smoke, (Index) (gi & GlobalIndexMask));
+    }
+
+    /**
+     * Casts ptr from one class to another. If the classes belong to different
+     * modules, 'to' is mapped to the matching external class of this module;
+     * that mapping is set up when the module is loaded.
+     */
+    void *cast(void *ptr, const ModuleIndex& from, const ModuleIndex& to);
+
     inline void *cast(void *ptr, Index from, Index to) {
     if(!castFn) return ptr;
     return (*castFn)(ptr, from, to);
     }
 
+    /**
+     * Casts using a table generated with -ct. The entries of
+     * class 'from' are entries[start[from]] .. entries[start[from + 1] - 1],
+     * sorted by their target class. Pointers are returned unchanged if there
+     * is no entry for the target.
+     */
+    static inline void *tableCast(const CastEntry *entries, const unsigned int *start, void *ptr, Index from, Index to) {
+        unsigned int imin = start[from];
+        unsigned int imax = start[from + 1];
+
+        while (imin < imax) {
+            unsigned int icur = (imin + imax) / 2;
+            if (entries[icur].to == to)
+                return (*entries[icur].thunk)(ptr);
+
+            if (entries[icur].to > to) {
+                imax = icur;
+            } else {
+                imin = icur + 1;
+            }
+        }
+
+        return ptr;
+    }
+
+    /**
+     * Returns the function that calls the method directly, or 0 if there is
+     * none. Bindings can keep the pointer and call it with the object
+     * (already cast to the method's class) and the arguments.
+     */
+    inline MethodFn methodFn(Index method) {
+        return methodFns ? methodFns[method] : 0;
+    }
+
+    /**
+     * Returns the typed entry point of the method, or 0 if there is none.
+     */
+    inline TypedFn typedFn(Index method) {
+        return typedFns ? typedFns[method] : 0;
+    }
+
+    /**
+     * Calls the method, through its direct entry point if there is one,
+     * else through the classFn of the class.
+     */
+    inline void callMethod(Index method, void *obj, Stack args) {
+        if (methodFns && methodFns[method]) {
+            (*methodFns[method])(obj, args);
+            return;
+        }
+        (*classFn(methodClassId(method)))(methodCallIndex(method), obj, args);
+    }
+
+    /**
+     * One call of a batch, see callBatch().
+     */
+    struct Call {
+	Index method;		// Index into methods
+	void *obj;		// The object, already cast to the method's class, 0 for static methods
+	Stack args;		// Arguments and return value, like for callMethod()
+    };
+
+    /**
+     * Called after each call of a batch, returning false stops the batch.
+     */
+    typedef bool (*BatchCheck)(const Call& call, void *data);
+
+    /**
+     * Runs the calls (which have to be methods of this module) in order, like
+     * callMethod() does, but resolves the entry point only once for runs of
+     * calls to the same method. If check is given, it's called after every
+     * call and the batch stops when it returns false. Returns the number of
+     * calls made.
+     */
+    int callBatch(const Call *calls, int count, BatchCheck check = 0, void *data = 0);
+
+    /**
+     * Calls one of the special classFn indices (SetOverriddenMethod etc.)
+     * of the class, in the module that defines it if it's external. Returns
+     * false if that module isn't loaded.
+     */
+    inline bool callClassFn(Index classId, Index xi, void *obj, Stack x) {
+        Smoke *smoke = this;
+        if (classes[classId].external) {
+            ModuleIndex c = findClass(className(classId));
+            if (!c.smoke)
+                return false;
+            smoke = c.smoke;
+            classId = c.index;
+        }
+        (*smoke->classFn(classId))(xi, obj, x);
+        return true;
+    }
+
+    /**
+     * Tells an instance created through this module whether the binding
+     * overrides the virtual method (the index passed to
+     * SmokeBinding::callMethod()), or all of them if method is 0. Calls of
+     * methods that aren't overridden go straight to the C++ implementation
+     * instead of through SmokeBinding::callMethod(). Pure virtual methods
+     * always call the binding. Setting the binding resets all methods to
+     * overridden.
+     */
+    inline void setMethodOverridden(Index classId, void *obj, Index method, bool overridden) {
+        StackItem x[3];
+        x[1].s_int = method;
+        x[2].s_bool = overridden;
+        callClassFn(classId, SetOverriddenMethod, obj, x);
+    }
+
+    /**
+     * Returns the size and alignment of the instances created by the
+     * constructors of the class. These are larger than Class::size, as the
+     * instances are of a generated subclass. Returns false if the class
+     * can't be instantiated, or if it's external and the module defining it
+     * isn't loaded.
+     */
+    inline bool instanceLayout(Index classId, unsigned int *size, unsigned int *alignment) {
+        StackItem x[2];
+        x[0].s_uint = 0;
+        x[1].s_uint = 0;
+        callClassFn(classId, InstanceLayout, 0, x);
+        *size = x[0].s_uint;
+        *alignment = x[1].s_uint;
+        return *size != 0;
+    }
+
+    /**
+     * Calls the destructor of an object without freeing its memory, for
+     * objects constructed into storage of the binding (see
+     * callingConvention). The class needs a public destructor. External
+     * classes are resolved to the module defining them.
+     * Instances created by a constructor with cc_constructInPlace are of the
+     * generated subclass, whose destructor notifies the binding like for
+     * deleted objects. Values returned with cc_returnInPlace are plain
+     * instances of the class, pass returnedValue = true for them.
+     */
+    inline void destroyInPlace(Index classId, void *obj, bool returnedValue = false) {
+        StackItem x[2];
+        x[1].s_bool = returnedValue;
+        callClassFn(classId, DestroyInPlace, obj, x);
+    }
+
+    /**
+     * Sets whether the destructor of an instance created through this module
+     * calls SmokeBinding::deleted(), e.g. to turn it off for temporaries the
+     * binding doesn't track. Setting the binding turns it on again.
+     */
+    inline void setDeletedNotification(Index classId, void *obj, bool notify) {
+        StackItem x[2];
+        x[1].s_bool = notify;
+        callClassFn(classId, SetDeletedNotification, obj, x);
+    }
+
+    // Used by the generated code, as class names can't always be used for destructor calls.
+    template<typename T>
+    static void destroy(T *obj) { obj->~T(); }
+
+    /**
+     * Records the type of the generated subclass used for instances created
+     * through a binding. Called by the generated code once per class, when
+     * the binding of its first instance is set.
+     */
+    static void addBindingType(const std::type_info& type);
+
+    /**
+     * Whether the dynamic type of an object was recorded by addBindingType(),
+     * i.e. the object was created through a binding. Types are compared by
+     * address, without a dynamic_cast; this is an out-of-line call and a
+     * lock-free hash table probe. The generated code first compares the
+     * type with its own subclass inline and only calls this for other
+     * types.
+     */
+    static bool isBindingType(const std::type_info& type);
+
     // return classname directly
     inline const char *className(Index classId) {
-	return classes[classId].className;
+	if (!strings)
+	    return classes[classId].className;
+	return classNameOffsets[classId] ? strings + classNameOffsets[classId] : 0;
+    }
+
+    inline Index methodClassId(Index method) {
+	return hotTables ? hotTables->methodClassIds[method] : methods[method].classId;
+    }
+
+    inline Index methodNameId(Index method) {
+	return hotTables ? hotTables->methodNameIds[method] : methods[method].name;
+    }
+
+    inline unsigned short methodFlags(Index method) {
+	return hotTables ? hotTables->methodFlags[method] : methods[method].flags;
+    }
+
+    inline Index methodReturnType(Index method) {
+	return hotTables ? hotTables->methodReturnTypes[method] : methods[method].ret;
+    }
+
+    inline Index methodCallIndex(Index method) {
+	return hotTables ? hotTables->methodCallIndices[method] : methods[method].method;
+    }
+
+    inline Index methodArgs(Index method) {
+	return hotTables ? hotTables->methodArgs[method] : methods[method].args;
+    }
+
+    inline unsigned char methodNumArgs(Index method) {
+	return hotTables ? hotTables->methodNumArgs[method] : methods[method].numArgs;
+    }
+
+    inline Index methodSignature(Index method) {
+	return hotTables ? hotTables->methodSignatures[method] : methods[method].signature;
+    }
+
+    inline ClassFn classFn(Index classId) {
+	return classes[classId].classFn;
+    }
+
+    inline Index typeClassId(Index typeId) {
+	return types[typeId].classId;
+    }
+
+    inline unsigned short typeFlags(Index typeId) {
+	return types[typeId].flags;
+    }
+
+    inline const char *typeName(Index typeId) {
+	if (!strings)
+	    return types[typeId].name;
+	return typeNameOffsets[typeId] ? strings + typeNameOffsets[typeId] : 0;
+    }
+
+    inline const char *methodName(Index nameId) {
+	if (!strings)
+	    return methodNames[nameId];
+	return strings + methodNameOffsets[nameId];
     }
 
     inline int leg(Index a, Index b) {  // ala Perl's <=>
@@ -356,7 +965,29 @@ public:
 	return (a > b) ? 1 : -1;
     }
 
+    /**
+     * FNV-1a hash of a string. The generator uses the same function to
+     * build the lookup hash tables, so it must not change.
+     */
+    static inline unsigned int hashString(const char *s) {
+        unsigned int h = 2166136261u;
+        for (; *s; ++s) {
+            h ^= (unsigned char) *s;
+            h *= 16777619u;
+        }
+        return h;
+    }
+
     inline Index idType(const char *t) {
+        if (typeHash) {
+            for (unsigned int i = hashString(t) & typeHashMask; typeHash[i]; i = (i + 1) & typeHashMask) {
+                if (strcmp(typeName(typeHash[i]), t) == 0) {
+                    return typeHash[i];
+                }
+            }
+            return 0;
+        }
+
         Index imax = numTypes;
         Index imin = 1;
         Index icur = -1;
@@ -364,7 +995,7 @@ public:
 
         while (imax >= imin) {
             icur = (imin + imax) / 2;
-            icmp = strcmp(types[icur].name, t);
+            icmp = strcmp(typeName(icur), t);
             if (icmp == 0) {
                 return icur;
             }
@@ -379,7 +1010,30 @@ public:
         return 0;
     }
 
+    /**
+     * Returns a process-wide id of the type, which is the same in all loaded
+     * modules for the same type name (ignoring whitespace) and type flags,
+     * e.g. for "const QString&" in every module using it. Ids are assigned
+     * when a module is loaded, start at 1 and are never reused, so bindings
+     * can key caches on them or use them as array indices. Type 0 has id 0.
+     */
+    unsigned int canonicalTypeId(Index typeId);
+
     inline ModuleIndex idClass(const char *c, bool external = false) {
+        if (classHash) {
+            for (unsigned int i = hashString(c) & classHashMask; classHash[i]; i = (i + 1) & classHashMask) {
+                Index icur = classHash[i];
+                if (strcmp(className(icur), c) == 0) {
+                    if (classes[icur].external && !external) {
+                        return NullModuleIndex;
+                    } else {
+                        return ModuleIndex(this, icur);
+                    }
+                }
+            }
+            return NullModuleIndex;
+        }
+
         Index imax = numClasses;
         Index imin = 1;
         Index icur = -1;
@@ -387,7 +1041,7 @@ public:
 
         while (imax >= imin) {
             icur = (imin + imax) / 2;
-            icmp = strcmp(classes[icur].className, c);
+            icmp = strcmp(className(icur), c);
             if (icmp == 0) {
                 if (classes[icur].external && !external) {
                     return NullModuleIndex;
@@ -406,16 +1060,30 @@ public:
         return NullModuleIndex;
     }
 
-    static inline ModuleIndex findClass(const char *c) {
-        ClassMap::iterator i = classMap.find(c);
-        if (i == classMap.end()) {
-            return NullModuleIndex;
-        } else {
-            return i->second;
-        }
+    /**
+     * Looks up a class in all loaded modules. Returns the module which
+     * defines the class (i.e. where it isn't external) or NullModuleIndex.
+     * This doesn't allocate and is safe to call from multiple threads, also
+     * while other modules are being loaded.
+     * This replaces the Smoke::classMap of smokebase 3, which was removed:
+     * use findClass() instead of looking classes up in the map.
+     */
+    static ModuleIndex findClass(const char *c);
+
+    static inline GlobalIndex findClassGlobal(const char *c) {
+        return toGlobalIndex(findClass(c));
     }
 
     inline ModuleIndex idMethodName(const char *m) {
+        if (methodNameHash) {
+            for (unsigned int i = hashString(m) & methodNameHashMask; methodNameHash[i]; i = (i + 1) & methodNameHashMask) {
+                if (strcmp(methodName(methodNameHash[i]), m) == 0) {
+                    return ModuleIndex(this, methodNameHash[i]);
+                }
+            }
+            return NullModuleIndex;
+        }
+
         Index imax = numMethodNames;
         Index imin = 1;
         Index icur = -1;
@@ -423,7 +1091,7 @@ public:
 
         while (imax >= imin) {
             icur = (imin + imax) / 2;
-            icmp = strcmp(methodNames[icur], m);
+            icmp = strcmp(methodName(icur), m);
             if (icmp == 0) {
                 return ModuleIndex(this, icur);
             }
@@ -450,14 +1118,49 @@ public:
 	    for (Index p = classes[cmi.index].parents; inheritanceList[p]; p++) {
 		Index ci = inheritanceList[p];
 		const char* cName = className(ci);
-		ModuleIndex mi = classMap[cName].smoke->findMethodName(cName, m);
+		ModuleIndex pmi = findClass(cName);
+		if (!pmi.smoke) continue;
+		ModuleIndex mi = pmi.smoke->findMethodName(cName, m);
 		if (mi.index) return mi;
 	    }
 	}
 	return NullModuleIndex;
     }
 
+    inline GlobalIndex findMethodNameGlobal(const char *c, const char *m) {
+        return toGlobalIndex(findMethodName(c, m));
+    }
+
+    /**
+     * Returns the entries of the class in methods and methodMaps. Iterate
+     * with for (Index i = r.firstMethod; i < r.lastMethod; ++i) etc.
+     * Without a classRanges table, the ranges are found by binary search.
+     */
+    inline ClassRange classRange(Index classId) {
+        if (classRanges) return classRanges[classId];
+        return findClassRange(classId);
+    }
+
+    ClassRange findClassRange(Index classId);
+
     inline ModuleIndex idMethod(Index c, Index name) {
+        if (classRanges) {
+            // only search the method maps of the class, they are sorted by name
+            Index imin = classRanges[c].firstMethodMap;
+            Index imax = classRanges[c].lastMethodMap;
+            while (imin < imax) {
+                Index icur = imin + (imax - imin) / 2;
+                int icmp = leg(methodMaps[icur].name, name);
+                if (icmp == 0)
+                    return ModuleIndex(this, icur);
+                if (icmp > 0)
+                    imax = icur;
+                else
+                    imin = icur + 1;
+            }
+            return NullModuleIndex;
+        }
+
         Index imax = numMethodMaps;
         Index imin = 1;
         Index icur = -1;
@@ -483,28 +1186,73 @@ public:
         return NullModuleIndex;
     }
 
-    inline ModuleIndex findMethod(ModuleIndex c, ModuleIndex name) {
-        if (!c.index || !name.index) {
-            return NullModuleIndex;
-        } else if (name.smoke == this && c.smoke == this) {
-            ModuleIndex mi = idMethod(c.index, name.index);
-            if (mi.index) return mi;
-        } else if (c.smoke != this) {
-            return c.smoke->findMethod(c, name);
+    /**
+     * Returns the entry of the enum member 'name' (index into methodNames) of
+     * the class, or 0 if it isn't in enumValues.
+     */
+    inline const EnumValue *findEnumValue(Index c, Index name) {
+        Index imin = 1;
+        Index imax = numEnumValues;
+        while (imin < imax) {
+            Index icur = imin + (imax - imin) / 2;
+            int icmp = leg(enumValues[icur].classId, c);
+            if (icmp == 0)
+                icmp = leg(enumValues[icur].name, name);
+            if (icmp == 0)
+                return &enumValues[icur];
+            if (icmp > 0)
+                imax = icur;
+            else
+                imin = icur + 1;
         }
+        return 0;
+    }
 
-        for (Index *i = inheritanceList + classes[c.index].parents; *i; ++i) {
-            const char *cName = className(*i);
-            ModuleIndex ci = findClass(cName);
-            if (!ci.smoke)
-                return NullModuleIndex;
-            ModuleIndex ni = ci.smoke->findMethodName(cName, name.smoke->methodNames[name.index]);
-            ModuleIndex mi = ci.smoke->findMethod(ci, ni);
-            if (mi.index) return mi;
+    /**
+     * Returns the entry of the field of the class whose getter is called
+     * 'name' (index into methodNames), or 0 if it isn't in fields. The field
+     * is at (char*)obj + offset for instances cast to the class, or at
+     * address if it's static.
+     */
+    inline const Field *findField(Index c, Index name) {
+        Index imin = 1;
+        Index imax = numFields;
+        while (imin < imax) {
+            Index icur = imin + (imax - imin) / 2;
+            int icmp = leg(fields[icur].classId, c);
+            if (icmp == 0)
+                icmp = leg(fields[icur].name, name);
+            if (icmp == 0)
+                return &fields[icur];
+            if (icmp > 0)
+                imax = icur;
+            else
+                imin = icur + 1;
         }
-        return NullModuleIndex;
+        return 0;
+    }
+
+    /**
+     * Reads the value of an enum member given by its entry in methods (one
+     * flagged mf_enum). Falls back to calling the method if the value isn't
+     * in enumValues, e.g. for protected enums.
+     */
+    inline long enumValue(Index method) {
+        if (const EnumValue *e = findEnumValue(methodClassId(method), methodNameId(method)))
+            return e->value;
+        StackItem x[1];
+        callMethod(method, 0, x);
+        return x[0].s_enum;
     }
 
+    /**
+     * Looks up the method map entry for the munged method name in the class
+     * or, if it isn't found there, in its base classes (also those of other
+     * modules). Results are cached per module, so after the first call for a
+     * (class, name) pair this is a single lock-free hash table probe.
+     */
+    ModuleIndex findMethod(ModuleIndex c, ModuleIndex name);
+
     inline ModuleIndex findMethod(const char *c, const char *name) {
         ModuleIndex idc = idClass(c);
         if (!idc.smoke) idc = findClass(c);
@@ -513,41 +1261,128 @@ public:
         return idc.smoke->findMethod(idc, idname);
     }
 
+    inline GlobalIndex findMethodGlobal(GlobalIndex c, GlobalIndex name) {
+        return toGlobalIndex(findMethod(fromGlobalIndex(c), fromGlobalIndex(name)));
+    }
+
+    inline GlobalIndex findMethodGlobal(const char *c, const char *name) {
+        return toGlobalIndex(findMethod(c, name));
+    }
+
     static inline bool isDerivedFrom(const ModuleIndex& classId, const ModuleIndex& baseClassId) {
         return isDerivedFrom(classId.smoke, classId.index, baseClassId.smoke, baseClassId.index);
     }
     
-    static inline bool isDerivedFrom(Smoke *smoke, Index classId, Smoke *baseSmoke, Index baseId) {
-	if (!classId || !baseId || !smoke || !baseSmoke)
-	    return false;
-	if (smoke == baseSmoke && classId == baseId)
-	    return true;
-	
-	for(Index p = smoke->classes[classId].parents; smoke->inheritanceList[p]; p++) {
-	    Class& cur = smoke->classes[smoke->inheritanceList[p]];
-	    if (cur.external) {
-		ModuleIndex mi = findClass(cur.className);
-		if (isDerivedFrom(mi.smoke, mi.index, baseSmoke, baseId))
-		    return true;
-	    }
-	    if (isDerivedFrom(smoke, smoke->inheritanceList[p], baseSmoke, baseId))
-		return true;
-	}
-	return false;
-    }
+    /**
+     * Whether the class is the base class or derived from it. External
+     * classes are treated like the classes they refer to. The ancestry of
+     * each class is precomputed when its module is loaded, so this is a
+     * hash set lookup; a module has to be loaded after its parent modules
+     * for that to work, else the hierarchy is walked.
+     */
+    static bool isDerivedFrom(Smoke *smoke, Index classId, Smoke *baseSmoke, Index baseId);
 
     static inline bool isDerivedFrom(const char *className, const char *baseClassName) {
     ModuleIndex classId = findClass(className);
     ModuleIndex baseId = findClass(baseClassName);
     return isDerivedFrom(classId.smoke, classId.index, baseId.smoke, baseId.index);
     }
+
+    /**
+     * Type of an argument passed to resolveOverload().
+     */
+    struct ArgType {
+	TypeId type;		// The StackItem field holding the argument
+	ModuleIndex classId;	// For t_class, the class of the object, NullModuleIndex for a null pointer
+    };
+
+    /**
+     * Remembers the last resolveOverload() result of one call site in the
+     * calling code, e.g. one call expression of a script. Not thread-safe,
+     * there has to be one per call site and thread.
+     */
+    struct CallSiteCache {
+        CallSiteCache() : generation(0), entry(0) {}
+        unsigned int generation;
+        const void *entry;
+    };
+
+    /**
+     * Picks the method (not munged name) of the class, or if the class has
+     * none with that name, of its nearest base classes, that matches the
+     * argument types best. Returns an index into methods.
+     *
+     * Candidates need the same number of arguments. Each argument adds to
+     * the cost of a candidate: 0 for the same type, the inheritance distance
+     * for objects, 1 for conversions within integral or floating point
+     * types, 2 for integral <-> floating point and enum -> integral, 3 for
+     * conversions involving bool and 4 for integral -> enum. If more than
+     * one candidate has the lowest cost, 'ambiguous' is set to true and one
+     * of them is returned.
+     *
+     * Results are cached globally; if a cache is passed, a repeated call
+     * with the same arguments only compares them with the cached ones.
+     */
+    static ModuleIndex resolveOverload(const ModuleIndex& classId, const char *name, const ArgType *args, int numArgs,
+                                       bool *ambiguous = 0, CallSiteCache *cache = 0);
+
+    static inline GlobalIndex resolveOverloadGlobal(const ModuleIndex& classId, const char *name, const ArgType *args,
+                                                    int numArgs, bool *ambiguous = 0, CallSiteCache *cache = 0) {
+        return toGlobalIndex(resolveOverload(classId, name, args, numArgs, ambiguous, cache));
+    }
+};
+
+/**
+ * Bounded lock-free queue of deleted objects. Any number of threads can
+ * push, one thread at a time may drain it.
+ * The memory of a queued object may already be reused by a new object at
+ * the same address. A binding that maps pointers to its own objects has to
+ * drain the queue before adding a mapping for a new object, otherwise a
+ * later drain would remove the mapping of the new object.
+ */
+class BASE_SMOKE_EXPORT SmokeDeletionQueue {
+public:
+    struct Entry {
+	Smoke::Index classId;
+	void *obj;
+    };
+
+    // The capacity is rounded up to a power of two.
+    explicit SmokeDeletionQueue(unsigned int capacity);
+    ~SmokeDeletionQueue();
+
+    // Returns false if the queue is full.
+    bool push(Smoke::Index classId, void *obj);
+    // Moves up to max entries to 'entries', oldest first, and returns their number.
+    int drain(Entry *entries, int max);
+
+private:
+    SmokeDeletionQueue(const SmokeDeletionQueue&);
+    SmokeDeletionQueue& operator=(const SmokeDeletionQueue&);
+
+    struct Private;
+    Private *d;
 };
 
 class SmokeBinding {
 protected:
     Smoke *smoke;
+    /**
+     * If set, the generated destructors push the deleted objects to the
+     * queue, for the binding to drain in bulk, instead of calling deleted().
+     * deleted() is still called if the queue is full. Drain the queue
+     * before mapping new objects, see SmokeDeletionQueue.
+     */
+    SmokeDeletionQueue *deletionQueue;
 public:
-    SmokeBinding(Smoke *s) : smoke(s) {}
+    SmokeBinding(Smoke *s) : smoke(s), deletionQueue(0) {}
+    /**
+     * Called by the generated destructors.
+     */
+    inline void objectDeleted(Smoke::Index classId, void *obj) {
+        if (!deletionQueue || !deletionQueue->push(classId, obj))
+            deleted(classId, obj);
+    }
     virtual void deleted(Smoke::Index classId, void *obj) = 0;
     virtual bool callMethod(Smoke::Index method, void *obj, Smoke::Stack args, bool isAbstract = false) = 0;
     virtual char* className(Smoke::Index classId) = 0;
@@ -57,65 +57,76 @@ loadSmokeModule(QString moduleName) {
     return *smoke;
 }
 
+static Smoke*
+loadSmokeImage(QString fileName) {
+    Smoke* smoke = Smoke::loadImage(QFile::encodeName(fileName));
+    if (!smoke)
+        qFatal("Couldn't load module image %s", qPrintable(fileName));
+    return smoke;
+}
+
 static QString
 methodToString(Smoke::ModuleIndex methodId)
 {
     QString result;
     Smoke * smoke = methodId.smoke;
-    Smoke::Method& methodRef = smoke->methods[methodId.index];
+    // modules generated with -hc have no methods array
+    unsigned short flags = smoke->methodFlags(methodId.index);
+    Smoke::Index classId = smoke->methodClassId(methodId.index);
+    Smoke::Index name = smoke->methodNameId(methodId.index);
     
-    if ((methodRef.flags & Smoke::mf_signal) != 0) {
+    if ((flags & Smoke::mf_signal) != 0) {
         result.append("signal ");
     }
     
-    if ((methodRef.flags & Smoke::mf_slot) != 0) {
+    if ((flags & Smoke::mf_slot) != 0) {
         result.append("slot ");
     }
     
-    const char * typeName = smoke->types[methodRef.ret].name;
+    const char * typeName = smoke->typeName(smoke->methodReturnType(methodId.index));
     
-    if ((methodRef.flags & Smoke::mf_enum) != 0) {
+    if ((flags & Smoke::mf_enum) != 0) {
         result.append(QString("enum %1::%2")
-                            .arg(smoke->classes[methodRef.classId].className)
-                            .arg(smoke->methodNames[methodRef.name]) );
+                            .arg(smoke->className(classId))
+                            .arg(smoke->methodName(name)) );
         return result;
     }
     
-    if ((methodRef.flags & Smoke::mf_virtual) != 0) {
+    if ((flags & Smoke::mf_virtual) != 0) {
         result.append("virtual ");
     }
     
-    if (	(methodRef.flags & Smoke::mf_static) != 0
-            && (smoke->classes[methodRef.classId].flags & Smoke::cf_namespace) == 0 )
+    if (	(flags & Smoke::mf_static) != 0
+            && (smoke->classes[classId].flags & Smoke::cf_namespace) == 0 )
     {
         result.append("static ");
     }
     
-    if ((methodRef.flags & Smoke::mf_ctor) == 0) {
+    if ((flags & Smoke::mf_ctor) == 0) {
         result.append((typeName != 0 ? typeName : "void"));
         result.append(" ");
     }
     
     result.append(  QString("%1::%2(")
-                        .arg(smoke->classes[methodRef.classId].className)
-                        .arg(smoke->methodNames[methodRef.name]) );
+                        .arg(smoke->className(classId))
+                        .arg(smoke->methodName(name)) );
                         
-    for (int i = 0; i < methodRef.numArgs; i++) {
+    for (int i = 0; i < smoke->methodNumArgs(methodId.index); i++) {
         if (i > 0) {
             result.append(", ");
         }
         
-        typeName = smoke->types[smoke->argumentList[methodRef.args+i]].name;
+        typeName = smoke->typeName(smoke->argumentList[smoke->methodArgs(methodId.index)+i]);
         result.append((typeName != 0 ? typeName : "void"));
     }
     
     result.append(")");
     
-    if ((methodRef.flags & Smoke::mf_const) != 0) {
+    if ((flags & Smoke::mf_const) != 0) {
         result.append(" const");
     }
     
-    if ((methodRef.flags & Smoke::mf_purevirtual) != 0) {
+    if ((flags & Smoke::mf_purevirtual) != 0) {
         result.append(" = 0");
     }
     
@@ -132,7 +143,7 @@ getAllParents(const Smoke::ModuleIndex& classId, int indent)
             *parent != 0; 
             parent++ ) 
     {
-        Smoke::ModuleIndex parentId = Smoke::findClass(smoke->classes[*parent].className);
+        Smoke::ModuleIndex parentId = Smoke::findClass(smoke->className(*parent));
         Q_ASSERT(parentId != Smoke::NullModuleIndex);
         result << getAllParents(parentId, indent + 1);
     }
@@ -145,7 +156,7 @@ static void
 showClass(const Smoke::ModuleIndex& classId, int indent)
 {
     if (showClassNamesOnly) {
-        QString className = QString::fromLatin1(classId.smoke->classes[classId.index].className);    
+        QString className = QString::fromLatin1(classId.smoke->className(classId.index));    
         if (!matchPattern || targetPattern.indexIn(className) != -1) {
 			while (indent > 0) {
 				qOut << "  ";
@@ -158,62 +169,31 @@ showClass(const Smoke::ModuleIndex& classId, int indent)
     }
     
     Smoke * smoke = classId.smoke;
-    Smoke::Index imax = smoke->numMethodMaps;
-    Smoke::Index imin = 0, icur = -1, methmin, methmax;
-    methmin = -1; methmax = -1; // kill warnings
-    int icmp = -1;
+    Smoke::ClassRange range = smoke->classRange(classId.index);
 
-    while (imax >= imin) {
-        icur = (imin + imax) / 2;
-        icmp = smoke->leg(smoke->methodMaps[icur].classId, classId.index);
-        if (icmp == 0) {
-            Smoke::Index pos = icur;
-            while (icur != 0 && smoke->methodMaps[icur-1].classId == classId.index) {
-                icur --;
+    for (Smoke::Index i = range.firstMethodMap; i < range.lastMethodMap; i++) {
+        Smoke::Index ix = smoke->methodMaps[i].method;
+        if (ix >= 0) {  // single match
+            QString method = methodToString(Smoke::ModuleIndex(smoke, ix));
+            if (!matchPattern || targetPattern.indexIn(method) != -1) {
+                qOut << method << "\n";
             }
-            
-            methmin = icur;
-            icur = pos;
-            while (icur < imax && smoke->methodMaps[icur+1].classId == classId.index) {
-                icur ++;
-            }
-            
-            methmax = icur;
-            break;
-        }
-        
-        if (icmp > 0) {
-            imax = icur - 1;
-        } else {
-            imin = icur + 1;
-        }
-    }
-
-    if (icmp == 0) {
-        for (Smoke::Index i = methmin ; i <= methmax ; i++) {
-            Smoke::Index ix = smoke->methodMaps[i].method;
-            if (ix >= 0) {  // single match
-                QString method = methodToString(Smoke::ModuleIndex(smoke, ix));
+        } else {        // multiple match
+            ix = -ix;       // turn into ambiguousMethodList index
+            while (smoke->ambiguousMethodList[ix]) {
+                QString method = methodToString(Smoke::ModuleIndex(smoke, smoke->ambiguousMethodList[ix]));
                 if (!matchPattern || targetPattern.indexIn(method) != -1) {
                     qOut << method << "\n";
                 }
-            } else {        // multiple match
-                ix = -ix;       // turn into ambiguousMethodList index
-                while (smoke->ambiguousMethodList[ix]) {
-                    QString method = methodToString(Smoke::ModuleIndex(smoke, smoke->ambiguousMethodList[ix]));
-                    if (!matchPattern || targetPattern.indexIn(method) != -1) {
-                        qOut << method << "\n";
-                    }
-                    
-                    ix++;
-                }
+                
+                ix++;
             }
         }
     }
 }
 
 #define PRINT_USAGE() \
-    qDebug() << "Usage:" << argv[0] << "-r <smoke lib> [-r more smoke libs..] [-c] [-p] [-m pattern] [-i] [<classname(s)>..]"
+    qDebug() << "Usage:" << argv[0] << "-r <smoke lib> [-r more smoke libs..] [-l <module image>] [-w <module image>] [-c] [-p] [-m pattern] [-i] [<classname(s)>..]"
 
 int main(int argc, char** argv)
 {
@@ -241,6 +221,21 @@ int main(int argc, char** argv)
                 smokeModules << loadSmokeModule(arguments[i]);
             }
             i++;
+        } else if (arguments[i] == QLatin1String("-l") || arguments[i] == QLatin1String("--load-image")) {
+            i++;
+            if (i < arguments.length()) {
+                smokeModules << loadSmokeImage(arguments[i]);
+            }
+            i++;
+        } else if (arguments[i] == QLatin1String("-w") || arguments[i] == QLatin1String("--write-image")) {
+            i++;
+            if (i < arguments.length()) {
+                if (smokeModules.isEmpty())
+                    qFatal("Error: no module to write, use -r before -w");
+                if (!smokeModules.last()->writeImage(QFile::encodeName(arguments[i])))
+                    qFatal("Error: couldn't write '%s'", qPrintable(arguments[i]));
+            }
+            i++;
         } else if (arguments[i] == QLatin1String("-c") || arguments[i] == QLatin1String("--classes")) {
             showClassNamesOnly = true;
             i++;
@@ -266,7 +261,13 @@ int main(int argc, char** argv)
         targetPattern.setCaseSensitivity(Qt::CaseInsensitive);
     }
     
-    smokeModules << loadSmokeModule("qtcore");
+    bool haveQtCore = false;
+    foreach (Smoke * smoke, smokeModules) {
+        if (qstrcmp(smoke->moduleName(), "qtcore") == 0)
+            haveQtCore = true;
+    }
+    if (!haveQtCore)
+        smokeModules << loadSmokeModule("qtcore");
     
     if (i >= arguments.length()) {
         if (targetPattern.isEmpty()) {
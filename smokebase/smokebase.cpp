@@ -2,5 +2,1560 @@
 
 #include <smoke.h>
 
-Smoke::ClassMap Smoke::classMap;
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 Smoke::ModuleIndex Smoke::NullModuleIndex;
+
+const int SMOKE_INDEX_ABI_TAG = sizeof(Smoke::Index);
+
+namespace {
+
+// Open-addressing hash table of entry pointers. A slot only ever changes from 0 to a fully initialized entry;
+// any other modification builds a new table that replaces the old one as a whole. That way readers can probe
+// the table without taking a lock, even while another thread inserts entries.
+// Entry needs a 'hash' member, a key() and a matches(key) function.
+template<typename Entry>
+struct AtomicTable {
+    explicit AtomicTable(unsigned int size) : mask(size - 1), count(0), slots(new std::atomic<const Entry*>[size]) {
+        for (unsigned int i = 0; i < size; ++i)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+    ~AtomicTable() { delete[] slots; }
+
+    // Inserts or replaces an entry. Only safe on tables that have not been published yet.
+    void set(const Entry *entry) {
+        unsigned int i = entry->hash & mask;
+        for (const Entry *e; (e = slots[i].load(std::memory_order_relaxed)); i = (i + 1) & mask) {
+            if (e->hash == entry->hash && e->matches(entry->key())) {
+                slots[i].store(entry, std::memory_order_relaxed);
+                return;
+            }
+        }
+        slots[i].store(entry, std::memory_order_relaxed);
+        ++count;
+    }
+
+    // Inserts an entry whose key is not in the table yet. Writers have to be serialized by the caller.
+    void insert(const Entry *entry) {
+        unsigned int i = entry->hash & mask;
+        while (slots[i].load(std::memory_order_relaxed))
+            i = (i + 1) & mask;
+        slots[i].store(entry, std::memory_order_release);
+        ++count;
+    }
+
+    template<typename Key>
+    const Entry *find(const Key& key, unsigned int hash) const {
+        for (unsigned int i = hash & mask; ; i = (i + 1) & mask) {
+            const Entry *e = slots[i].load(std::memory_order_acquire);
+            if (!e || (e->hash == hash && e->matches(key)))
+                return e;
+        }
+    }
+
+    // Whether adding n entries would fill more than half of the slots.
+    bool isFull(unsigned int n) const { return (count + n) * 2 > mask + 1; }
+
+    void copyTo(AtomicTable *other) const {
+        for (unsigned int i = 0; i <= mask; ++i) {
+            if (const Entry *e = slots[i].load(std::memory_order_relaxed))
+                other->set(e);
+        }
+    }
+
+    unsigned int mask;
+    unsigned int count;
+    std::atomic<const Entry*> *slots;
+};
+
+// Incremented whenever a module is registered or removed. Lookups resolved before that might be stale, so they
+// are not added to the caches.
+std::atomic<unsigned int> moduleGeneration(0);
+
+// Cache of lookup results, readable without locking. Published entries are owned by the cache and are only freed
+// together with it, since other threads might still be reading them after clear().
+template<typename Entry>
+class AtomicCache {
+public:
+    typedef AtomicTable<Entry> Table;
+
+    AtomicCache() : table(new Table(64)) {}
+
+    ~AtomicCache() {
+        delete table.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < retired.size(); ++i)
+            delete retired[i];
+        for (size_t i = 0; i < entries.size(); ++i)
+            delete entries[i];
+    }
+
+    template<typename Key>
+    const Entry *find(const Key& key, unsigned int hash) const {
+        return table.load(std::memory_order_acquire)->find(key, hash);
+    }
+
+    // Takes ownership of the entry. 'generation' is the value of moduleGeneration before the entry was resolved.
+    // Returns the entry if it was published; a stale or duplicate entry was never visible to readers, so it is
+    // deleted right away and 0 is returned.
+    const Entry *insert(Entry *entry, unsigned int generation) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Table *current = table.load(std::memory_order_relaxed);
+        if (generation != moduleGeneration.load(std::memory_order_acquire) || current->find(entry->key(), entry->hash)) {
+            delete entry;
+            return 0;
+        }
+
+        entries.push_back(entry);
+        if (current->isFull(1)) {
+            Table *newTable = new Table((current->mask + 1) * 2);
+            current->copyTo(newTable);
+            newTable->set(entry);
+            retired.push_back(current);
+            table.store(newTable, std::memory_order_release);
+        } else {
+            current->insert(entry);
+        }
+        return entry;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.push_back(table.exchange(new Table(64), std::memory_order_acq_rel));
+    }
+
+private:
+    std::mutex mutex;
+    std::atomic<Table*> table;
+    std::vector<Table*> retired;
+    std::vector<Entry*> entries;
+};
+
+struct ClassEntry {
+    const char *name;
+    unsigned int hash;
+    Smoke::ModuleIndex index;
+
+    const char *key() const { return name; }
+    bool matches(const char *other) const { return strcmp(name, other) == 0; }
+};
+
+struct MethodKey {
+    Smoke::Index classId;
+    Smoke::ModuleIndex name;
+};
+
+struct MethodEntry {
+    MethodKey k;
+    unsigned int hash;
+    Smoke::ModuleIndex method;
+
+    const MethodKey& key() const { return k; }
+    bool matches(const MethodKey& other) const { return k.classId == other.classId && k.name == other.name; }
+};
+
+struct TypeEntry {
+    const std::type_info *type;
+    unsigned int hash;
+
+    const std::type_info *key() const { return type; }
+    bool matches(const std::type_info *other) const { return type == other; }
+};
+
+inline unsigned int hashPointer(const void *p)
+{
+    size_t v = reinterpret_cast<size_t>(p);
+    unsigned int h = (unsigned int) (v ^ (v >> 16)) * 0x9e3779b1u;
+    return h ^ (h >> 15);
+}
+
+// Never destroyed, generated code can still ask for types during static destruction.
+AtomicCache<TypeEntry>& bindingTypes()
+{
+    static AtomicCache<TypeEntry> *types = new AtomicCache<TypeEntry>;
+    return *types;
+}
+
+// Hash of an index into one module combined with an index into any module.
+inline unsigned int hashIndexPair(Smoke::Index id, const Smoke::ModuleIndex& mi)
+{
+    size_t smoke = reinterpret_cast<size_t>(mi.smoke);
+    unsigned int h = (unsigned int) (smoke ^ (smoke >> 16)) * 0x9e3779b1u;
+    h ^= (unsigned int) id * 0x85ebca6bu + (unsigned int) mi.index;
+    return h ^ (h >> 15);
+}
+
+Smoke::ModuleIndex resolveInheritedMethod(Smoke *smoke, Smoke::ModuleIndex c, Smoke::ModuleIndex name)
+{
+    if (name.smoke == smoke) {
+        Smoke::ModuleIndex mi = smoke->idMethod(c.index, name.index);
+        if (mi.index) return mi;
+    }
+
+    for (Smoke::Index *i = smoke->inheritanceList + smoke->classes[c.index].parents; *i; ++i) {
+        const char *cName = smoke->className(*i);
+        Smoke::ModuleIndex ci = Smoke::findClass(cName);
+        if (!ci.smoke)
+            return Smoke::NullModuleIndex;
+        Smoke::ModuleIndex ni = ci.smoke->findMethodName(cName, name.smoke->methodName(name.index));
+        Smoke::ModuleIndex mi = ci.smoke->findMethod(ci, ni);
+        if (mi.index) return mi;
+    }
+    return Smoke::NullModuleIndex;
+}
+
+// Walks the inheritance lists. Only used for classes whose ancestry could not be precomputed, because one of
+// their base classes lives in a module that wasn't loaded yet.
+bool isDerivedFromSlow(Smoke *smoke, Smoke::Index classId, Smoke *baseSmoke, Smoke::Index baseId)
+{
+    if (!classId || !baseId || !smoke || !baseSmoke)
+        return false;
+    if (smoke == baseSmoke && classId == baseId)
+        return true;
+
+    for (Smoke::Index p = smoke->classes[classId].parents; smoke->inheritanceList[p]; p++) {
+        if (smoke->classes[smoke->inheritanceList[p]].external) {
+            Smoke::ModuleIndex mi = Smoke::findClass(smoke->className(smoke->inheritanceList[p]));
+            if (isDerivedFromSlow(mi.smoke, mi.index, baseSmoke, baseId))
+                return true;
+        }
+        if (isDerivedFromSlow(smoke, smoke->inheritanceList[p], baseSmoke, baseId))
+            return true;
+    }
+    return false;
+}
+
+struct AncestorEntry {
+    AncestorEntry() : classId(0) {}
+    Smoke::Index classId;
+    Smoke::ModuleIndex ancestor;
+};
+
+}
+
+namespace {
+
+// Maps the file read-only, or reads it where mmap() isn't available. Returns 0 on errors.
+char *mapImage(const char *path, size_t *size)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        *size = st.st_size;
+        data = mmap(0, *size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return data == MAP_FAILED ? 0 : (char *) data;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    char *data = 0;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long length = ftell(f);
+        if (length > 0 && fseek(f, 0, SEEK_SET) == 0) {
+            *size = length;
+            data = new char[*size];
+            if (fread(data, 1, *size, f) != *size) {
+                delete[] data;
+                data = 0;
+            }
+        }
+    }
+    fclose(f);
+    return data;
+#endif
+}
+
+void unmapImage(char *data, size_t size)
+{
+#ifndef _WIN32
+    munmap(data, size);
+#else
+    (void) size;
+    delete[] data;
+#endif
+}
+
+}
+
+struct Smoke::Private {
+    Private() : ancestorMask(0), image(0), imageSize(0) {}
+    ~Private() {
+        if (image)
+            unmapImage(image, imageSize);
+    }
+
+    // Resolves every class of the module to the module defining it, and fills the reverse mapping from the
+    // classes of other modules to the external classes of this one.
+    // Like buildAncestry(), this must be called before the module is visible to other threads.
+    void resolveClasses(Smoke *smoke) {
+        canonical.resize(smoke->numClasses + 1);
+        incomplete.assign(smoke->numClasses + 1, 0);
+
+        for (Smoke::Index i = 1; i <= smoke->numClasses; ++i) {
+            if (!smoke->classes[i].external) {
+                canonical[i] = Smoke::ModuleIndex(smoke, i);
+                continue;
+            }
+            canonical[i] = Smoke::findClass(smoke->className(i));
+            if (!canonical[i].smoke) {
+                canonical[i] = Smoke::ModuleIndex(smoke, i);
+                incomplete[i] = 1;
+                continue;
+            }
+            // modules without an id (see registerClasses()) fall back to lookups by name in cast()
+            const Smoke *other = canonical[i].smoke;
+            if (!other->module_id)
+                continue;
+            if (externalIndex.size() <= other->module_id)
+                externalIndex.resize(other->module_id + 1);
+            ExternalClasses& external = externalIndex[other->module_id];
+            if (external.map.empty()) {
+                external.smoke = other;
+                external.map.assign(other->numClasses + 1, 0);
+            }
+            external.map[canonical[i].index] = i;
+        }
+    }
+
+    // Collects the transitive base classes of all classes into a hash set, so isDerivedFrom() doesn't have to
+    // walk the hierarchy. The data is immutable afterwards.
+    void buildAncestry(Smoke *smoke) {
+        ancestorStart.assign(smoke->numClasses + 2, 0);
+        std::vector<char> state(smoke->numClasses + 1, 0);
+        std::vector<std::vector<Smoke::ModuleIndex> > lists(smoke->numClasses + 1);
+
+        for (Smoke::Index i = 1; i <= smoke->numClasses; ++i)
+            collectAncestors(smoke, i, state, lists);
+
+        size_t total = 0;
+        for (Smoke::Index i = 1; i <= smoke->numClasses; ++i) {
+            ancestorStart[i] = total;
+            total += lists[i].size();
+        }
+        ancestorStart[smoke->numClasses + 1] = total;
+        ancestorList.reserve(total);
+
+        unsigned int size = 16;
+        while (size < total * 2)
+            size <<= 1;
+        ancestorMask = size - 1;
+        ancestors.assign(size, AncestorEntry());
+        for (Smoke::Index i = 1; i <= smoke->numClasses; ++i) {
+            for (size_t j = 0; j < lists[i].size(); ++j) {
+                ancestorList.push_back(lists[i][j]);
+                unsigned int slot = hashIndexPair(i, lists[i][j]) & ancestorMask;
+                while (ancestors[slot].classId)
+                    slot = (slot + 1) & ancestorMask;
+                ancestors[slot].classId = i;
+                ancestors[slot].ancestor = lists[i][j];
+            }
+        }
+    }
+
+    bool hasAncestor(Smoke::Index classId, const Smoke::ModuleIndex& ancestor) const {
+        for (unsigned int i = hashIndexPair(classId, ancestor) & ancestorMask; ancestors[i].classId; i = (i + 1) & ancestorMask) {
+            if (ancestors[i].classId == classId && ancestors[i].ancestor == ancestor)
+                return true;
+        }
+        return false;
+    }
+
+    // Fills lists[classId] with the canonical indices of the class and all of its base classes.
+    void collectAncestors(Smoke *smoke, Smoke::Index classId, std::vector<char>& state,
+                          std::vector<std::vector<Smoke::ModuleIndex> >& lists)
+    {
+        if (state[classId])
+            return;
+        state[classId] = 1;
+
+        std::vector<Smoke::ModuleIndex>& list = lists[classId];
+        const Smoke::ModuleIndex& self = canonical[classId];
+        if (self.smoke != smoke) {
+            // external class, copy the ancestry computed by the module defining it
+            const Private *other = self.smoke->d;
+            list.assign(other->ancestorList.begin() + other->ancestorStart[self.index],
+                        other->ancestorList.begin() + other->ancestorStart[self.index + 1]);
+            incomplete[classId] = other->incomplete[self.index];
+            return;
+        }
+
+        list.push_back(self);
+        if (!smoke->classes[classId].parents)
+            return;
+        for (Smoke::Index p = smoke->classes[classId].parents; smoke->inheritanceList[p]; ++p) {
+            Smoke::Index parent = smoke->inheritanceList[p];
+            collectAncestors(smoke, parent, state, lists);
+            if (incomplete[parent])
+                incomplete[classId] = 1;
+            for (size_t j = 0; j < lists[parent].size(); ++j) {
+                // with multiple inheritance, a base class can be reached on more than one path
+                bool found = false;
+                for (size_t k = 0; k < list.size() && !found; ++k)
+                    found = (list[k] == lists[parent][j]);
+                if (!found)
+                    list.push_back(lists[parent][j]);
+            }
+        }
+    }
+
+    // Results of findMethod(), including inherited methods and misses.
+    AtomicCache<MethodEntry> methodCache;
+
+    // The module defining each class, i.e. the class itself if it isn't external.
+    std::vector<Smoke::ModuleIndex> canonical;
+    // Whether a base class of the class couldn't be resolved when the module was loaded.
+    std::vector<char> incomplete;
+    // Canonical indices of each class and its bases: ancestorList[ancestorStart[c] .. ancestorStart[c + 1]).
+    std::vector<Smoke::ModuleIndex> ancestorList;
+    std::vector<size_t> ancestorStart;
+    // Hash set of (classId, canonical ancestor) pairs, classId is 0 for empty slots.
+    std::vector<AncestorEntry> ancestors;
+    unsigned int ancestorMask;
+    // externalIndex[moduleId()].map[i] is the external class of this module referring to class i of that module,
+    // or 0. Module ids are reused, so each map remembers the module it was built for.
+    struct ExternalClasses {
+        ExternalClasses() : smoke(0) {}
+        const Smoke *smoke;
+        std::vector<Smoke::Index> map;
+    };
+    std::vector<ExternalClasses> externalIndex;
+
+    // For modules created by loadImage(): the mapped image and the classes and types converted from it.
+    char *image;
+    size_t imageSize;
+    std::vector<Smoke::Class> imageClasses;
+    std::vector<Smoke::Type> imageTypes;
+
+    // The process-wide id of each type, see Smoke::canonicalTypeId().
+    std::vector<unsigned int> canonicalTypes;
+};
+
+namespace {
+
+inline const Smoke::ModuleIndex& canonicalClass(Smoke *smoke, Smoke::Index classId)
+{
+    return smoke->d->canonical[classId];
+}
+
+struct OverloadKey {
+    Smoke::ModuleIndex classId;
+    const char *name;
+    const Smoke::ArgType *args;
+    int numArgs;
+};
+
+struct OverloadEntry {
+    OverloadEntry(const OverloadKey& k, unsigned int h, unsigned int g)
+        : classId(k.classId), name(k.name), args(k.args, k.args + k.numArgs), hash(h), generation(g), ambiguous(false) {}
+
+    OverloadKey key() const {
+        OverloadKey k = { classId, name.c_str(), args.empty() ? 0 : &args[0], (int) args.size() };
+        return k;
+    }
+
+    bool matches(const OverloadKey& k) const {
+        if (classId != k.classId || (int) args.size() != k.numArgs || name != k.name)
+            return false;
+        for (int i = 0; i < k.numArgs; ++i) {
+            if (args[i].type != k.args[i].type || args[i].classId != k.args[i].classId)
+                return false;
+        }
+        return true;
+    }
+
+    Smoke::ModuleIndex classId;
+    std::string name;
+    std::vector<Smoke::ArgType> args;
+    unsigned int hash;
+    unsigned int generation;
+    Smoke::ModuleIndex method;
+    bool ambiguous;
+};
+
+unsigned int hashOverloadKey(const OverloadKey& key)
+{
+    unsigned int h = Smoke::hashString(key.name) ^ hashIndexPair(0, key.classId);
+    for (int i = 0; i < key.numArgs; ++i)
+        h = (h ^ hashIndexPair(key.args[i].type, key.args[i].classId)) * 16777619u;
+    return h;
+}
+
+// Never destroyed, see classRegistry().
+AtomicCache<OverloadEntry>& overloadCache()
+{
+    static AtomicCache<OverloadEntry> *cache = new AtomicCache<OverloadEntry>;
+    return *cache;
+}
+
+// Collects the methods called 'name' of the class. If there are none, the base classes are searched, as names
+// declared in a class hide those of its bases. Constructors and destructors are not inherited.
+void collectCandidates(const Smoke::ModuleIndex& c, const char *name, bool inherited, std::vector<Smoke::ModuleIndex>& candidates)
+{
+    Smoke *smoke = c.smoke;
+    Smoke::ModuleIndex n = smoke->idMethodName(name);
+    if (n.index) {
+        bool found = false;
+        Smoke::ClassRange range = smoke->classRange(c.index);
+        for (int i = range.firstMethod; i < range.lastMethod; ++i) {
+            if (smoke->methodNameId(i) != n.index || (inherited && (smoke->methodFlags(i) & (Smoke::mf_ctor | Smoke::mf_dtor))))
+                continue;
+            found = true;
+            Smoke::ModuleIndex mi(smoke, i);
+            // with multiple inheritance, a base class can be reached on more than one path
+            if (std::find(candidates.begin(), candidates.end(), mi) == candidates.end())
+                candidates.push_back(mi);
+        }
+        if (found)
+            return;
+    }
+
+    if (!smoke->classes[c.index].parents)
+        return;
+    for (Smoke::Index *p = smoke->inheritanceList + smoke->classes[c.index].parents; *p; ++p)
+        collectCandidates(canonicalClass(smoke, *p), name, true, candidates);
+}
+
+// Number of derivation steps from c to base, or -1 if c isn't derived from base.
+int inheritanceDistance(const Smoke::ModuleIndex& c, const Smoke::ModuleIndex& base)
+{
+    if (c == base)
+        return 0;
+    if (!Smoke::isDerivedFrom(c, base) || !c.smoke->classes[c.index].parents)
+        return -1;
+
+    int best = -1;
+    for (Smoke::Index *p = c.smoke->inheritanceList + c.smoke->classes[c.index].parents; *p; ++p) {
+        int distance = inheritanceDistance(canonicalClass(c.smoke, *p), base);
+        if (distance >= 0 && (best < 0 || distance + 1 < best))
+            best = distance + 1;
+    }
+    return best;
+}
+
+enum TypeCategory { tc_none, tc_bool, tc_integral, tc_floating, tc_enum };
+
+TypeCategory typeCategory(unsigned short type)
+{
+    switch (type) {
+    case Smoke::t_bool:
+        return tc_bool;
+    case Smoke::t_char: case Smoke::t_uchar: case Smoke::t_short: case Smoke::t_ushort:
+    case Smoke::t_int: case Smoke::t_uint: case Smoke::t_long: case Smoke::t_ulong:
+        return tc_integral;
+    case Smoke::t_float: case Smoke::t_double:
+        return tc_floating;
+    case Smoke::t_enum:
+        return tc_enum;
+    default:
+        return tc_none;
+    }
+}
+
+// Cost of passing the argument to a parameter of the given type, -1 if it can't be passed.
+int argumentCost(const Smoke::ArgType& arg, Smoke *smoke, Smoke::Index typeIndex)
+{
+    unsigned short flags = smoke->typeFlags(typeIndex);
+    unsigned short param = flags & Smoke::tf_elem;
+
+    if (arg.type == Smoke::t_class) {
+        Smoke::Index classId = smoke->typeClassId(typeIndex);
+        if (param != Smoke::t_class || classId <= 0)
+            return -1;
+        if (!arg.classId.smoke)
+            return (flags & Smoke::tf_ref) == Smoke::tf_ptr ? 1 : -1;
+        return inheritanceDistance(canonicalClass(arg.classId.smoke, arg.classId.index), canonicalClass(smoke, classId));
+    }
+    if (arg.type == param)
+        return 0;
+
+    TypeCategory from = typeCategory(arg.type);
+    TypeCategory to = typeCategory(param);
+    if (from == tc_none || to == tc_none)
+        return -1;
+    if (from == to)
+        return 1;
+    if ((from == tc_integral && to == tc_floating) || (from == tc_floating && to == tc_integral) || (from == tc_enum && to == tc_integral))
+        return 2;
+    if (from == tc_bool || to == tc_bool || from == tc_enum)
+        return 3;
+    // integral to enum, C++ needs a cast for that
+    return 4;
+}
+
+Smoke::ModuleIndex resolveOverloadUncached(const Smoke::ModuleIndex& c, const char *name, const Smoke::ArgType *args, int numArgs, bool *ambiguous)
+{
+    std::vector<Smoke::ModuleIndex> candidates;
+    collectCandidates(c, name, false, candidates);
+
+    Smoke::ModuleIndex best;
+    int bestCost = -1;
+    *ambiguous = false;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        Smoke *smoke = candidates[i].smoke;
+        Smoke::Index method = candidates[i].index;
+        if (smoke->methodNumArgs(method) != numArgs)
+            continue;
+
+        const Smoke::Index *argTypes = smoke->argumentList + smoke->methodArgs(method);
+        int cost = 0;
+        for (int j = 0; j < numArgs && cost >= 0; ++j) {
+            int argCost = argumentCost(args[j], smoke, argTypes[j]);
+            cost = argCost < 0 ? -1 : cost + argCost;
+        }
+        if (cost < 0)
+            continue;
+
+        if (bestCost < 0 || cost < bestCost) {
+            best = candidates[i];
+            bestCost = cost;
+            *ambiguous = false;
+        } else if (cost == bestCost) {
+            *ambiguous = true;
+        }
+    }
+    return best;
+}
+
+class ClassRegistry {
+public:
+    ClassRegistry() : table(new ClassTable(1024)) {}
+
+    Smoke::ModuleIndex find(const char *name) const {
+        const ClassEntry *e = table.load(std::memory_order_acquire)->find(name, Smoke::hashString(name));
+        return e ? e->index : Smoke::NullModuleIndex;
+    }
+
+    void add(Smoke *smoke) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Module module = { smoke, new ClassEntry[smoke->numClasses], 0 };
+        for (Smoke::Index i = 1; i <= smoke->numClasses; ++i) {
+            if (smoke->classes[i].external)
+                continue;
+            ClassEntry& entry = module.entries[module.count++];
+            entry.name = smoke->className(i);
+            entry.hash = Smoke::hashString(entry.name);
+            entry.index = Smoke::ModuleIndex(smoke, i);
+        }
+        modules.push_back(module);
+
+        // Classes that are already registered are overridden by the new module, like assignments to a map would.
+        ClassTable *current = table.load(std::memory_order_relaxed);
+        bool rebuild = current->isFull(module.count);
+        for (int i = 0; i < module.count && !rebuild; ++i) {
+            if (current->find(module.entries[i].name, module.entries[i].hash))
+                rebuild = true;
+        }
+        if (rebuild) {
+            publish();
+        } else {
+            for (int i = 0; i < module.count; ++i)
+                current->insert(&module.entries[i]);
+        }
+
+        // Cached lookups may now resolve to classes of the new module.
+        clearCaches();
+    }
+
+    void remove(Smoke *smoke) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (size_t i = 0; i < modules.size(); ++i) {
+            if (modules[i].smoke == smoke) {
+                // Like the old table, the entries it points to are kept alive for readers that still use it. The
+                // names of modules loaded from an image point into the mapping, so that is kept as well.
+                retiredEntries.push_back(modules[i].entries);
+                if (smoke->d->image) {
+                    retiredImages.push_back(smoke->d->image);
+                    smoke->d->image = 0;
+                }
+                modules.erase(modules.begin() + i);
+                publish();
+                clearCaches();
+                return;
+            }
+        }
+    }
+
+private:
+    typedef AtomicTable<ClassEntry> ClassTable;
+
+    struct Module {
+        Smoke *smoke;
+        ClassEntry *entries;
+        int count;
+    };
+
+    // Builds a new table from all registered modules and replaces the current one with it. The old table is
+    // kept alive, because other threads might still be reading from it.
+    void publish() {
+        int total = 0;
+        for (size_t i = 0; i < modules.size(); ++i)
+            total += modules[i].count;
+        unsigned int size = 1024;
+        while (size < (unsigned int) total * 4)
+            size <<= 1;
+
+        ClassTable *newTable = new ClassTable(size);
+        for (size_t i = 0; i < modules.size(); ++i) {
+            for (int j = 0; j < modules[i].count; ++j)
+                newTable->set(&modules[i].entries[j]);
+        }
+        retired.push_back(table.exchange(newTable, std::memory_order_acq_rel));
+    }
+
+    void clearCaches() {
+        moduleGeneration.fetch_add(1, std::memory_order_acq_rel);
+        for (size_t i = 0; i < modules.size(); ++i)
+            modules[i].smoke->d->methodCache.clear();
+        overloadCache().clear();
+    }
+
+    std::mutex mutex;
+    std::atomic<ClassTable*> table;
+    std::vector<ClassTable*> retired;
+    std::vector<ClassEntry*> retiredEntries;
+    std::vector<char*> retiredImages;
+    std::vector<Module> modules;
+};
+
+// Never destroyed, modules may still be deleted from other static destructors at exit.
+ClassRegistry& classRegistry()
+{
+    static ClassRegistry *registry = new ClassRegistry;
+    return *registry;
+}
+
+// Canonical type ids, keyed by the type name without insignificant whitespace and the type flags. Ids are
+// never removed, so that they stay valid in the caches of the bindings when modules are unloaded.
+class TypeRegistry {
+public:
+    TypeRegistry() : nextId(1) {}
+
+    void add(Smoke *smoke, std::vector<unsigned int>& ids) {
+        ids.assign(smoke->numTypes + 1, 0);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Smoke::Index i = 1; i <= smoke->numTypes; ++i) {
+            std::string key = normalizedName(smoke->typeName(i));
+            key += '\0';
+            key += std::to_string(smoke->typeFlags(i));
+            std::unordered_map<std::string, unsigned int>::iterator it = types.find(key);
+            if (it == types.end())
+                it = types.insert(std::make_pair(key, nextId++)).first;
+            ids[i] = it->second;
+        }
+    }
+
+private:
+    static bool isIdentifierChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    // Drops all whitespace except single spaces between two words, as in "unsigned int".
+    static std::string normalizedName(const char *name) {
+        std::string result;
+        bool space = false;
+        for (const char *c = name; c && *c; ++c) {
+            if (*c == ' ' || *c == '\t') {
+                space = true;
+                continue;
+            }
+            if (space && !result.empty() && isIdentifierChar(result[result.size() - 1]) && isIdentifierChar(*c))
+                result += ' ';
+            space = false;
+            result += *c;
+        }
+        return result;
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, unsigned int> types;
+    unsigned int nextId;
+};
+
+TypeRegistry& typeRegistry()
+{
+    static TypeRegistry *registry = new TypeRegistry;
+    return *registry;
+}
+
+// The modules by their id in GlobalIndex. Slot 0 stays empty, so that a GlobalIndex of 0 is NullModuleIndex.
+class ModuleTable {
+public:
+    ModuleTable() {
+        for (int i = 0; i <= Smoke::MaxModules; ++i)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Returns the id of the module, 0 if all ids are taken.
+    unsigned int add(Smoke *smoke) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (unsigned int id = 1; id <= Smoke::MaxModules; ++id) {
+            if (!slots[id].load(std::memory_order_relaxed)) {
+                slots[id].store(smoke, std::memory_order_release);
+                return id;
+            }
+        }
+        return 0;
+    }
+
+    void remove(unsigned int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[id].store(0, std::memory_order_release);
+    }
+
+    Smoke *find(unsigned int id) const {
+        return id <= Smoke::MaxModules ? slots[id].load(std::memory_order_acquire) : 0;
+    }
+
+private:
+    std::mutex mutex;
+    std::atomic<Smoke*> slots[Smoke::MaxModules + 1];
+};
+
+ModuleTable& moduleTable()
+{
+    static ModuleTable *table = new ModuleTable;
+    return *table;
+}
+
+}
+
+Smoke::~Smoke()
+{
+    classRegistry().remove(this);
+    if (module_id)
+        moduleTable().remove(module_id);
+    delete d;
+}
+
+void Smoke::registerClasses(int indexSize, int abiTag)
+{
+    // Parent modules have passed the same check, so all loaded modules agree on the width.
+    if (indexSize != (int) sizeof(Index) || abiTag != (int) sizeof(Index)) {
+        fprintf(stderr, "smokebase: module '%s' uses %d byte indices, but smokebase was built with %d byte indices\n",
+                module_name, indexSize, (int) sizeof(Index));
+        abort();
+    }
+
+    module_id = moduleTable().add(this);
+    if (!module_id) {
+        // the module still works, only GlobalIndex isn't available for it
+        fprintf(stderr, "smokebase: no module id left for module '%s', there are already %d modules loaded; "
+                "its entries have no GlobalIndex\n", module_name, (int) MaxModules);
+    }
+    if (numClasses > GlobalIndexMask || numMethods > GlobalIndexMask || numMethodMaps > GlobalIndexMask
+        || numMethodNames > GlobalIndexMask || numTypes > GlobalIndexMask)
+    {
+        fprintf(stderr, "smokebase: module '%s' has more than %d entries in a table, its GlobalIndex values are truncated\n",
+                module_name, (int) GlobalIndexMask);
+    }
+
+    d = new Private;
+    typeRegistry().add(this, d->canonicalTypes);
+    d->resolveClasses(this);
+    d->buildAncestry(this);
+    classRegistry().add(this);
+}
+
+Smoke::ModuleIndex Smoke::findClass(const char *c)
+{
+    return classRegistry().find(c);
+}
+
+Smoke *Smoke::moduleForId(unsigned int id)
+{
+    return moduleTable().find(id);
+}
+
+unsigned int Smoke::canonicalTypeId(Index typeId)
+{
+    return d->canonicalTypes[typeId];
+}
+
+template<typename T>
+static inline Smoke::Index classIdOf(const T& entry) { return entry.classId; }
+// for HotTables::methodClassIds
+static inline Smoke::Index classIdOf(Smoke::Index classId) { return classId; }
+
+// Both tables are sorted by classId, find the first entry of classId and the first one of the following class.
+template<typename T>
+static Smoke::Index lowerBound(const T *table, Smoke::Index size, Smoke::Index classId)
+{
+    Smoke::Index imin = 1;
+    Smoke::Index imax = size;
+    while (imin < imax) {
+        Smoke::Index icur = imin + (imax - imin) / 2;
+        if (classIdOf(table[icur]) < classId)
+            imin = icur + 1;
+        else
+            imax = icur;
+    }
+    return imin;
+}
+
+Smoke::ClassRange Smoke::findClassRange(Index classId)
+{
+    ClassRange range;
+    // numMethods and numMethodMaps include the empty entry 0
+    if (hotTables) {
+        range.firstMethod = lowerBound(hotTables->methodClassIds, numMethods, classId);
+        range.lastMethod = lowerBound(hotTables->methodClassIds, numMethods, classId + 1);
+    } else {
+        range.firstMethod = lowerBound(methods, numMethods, classId);
+        range.lastMethod = lowerBound(methods, numMethods, classId + 1);
+    }
+    range.firstMethodMap = lowerBound(methodMaps, numMethodMaps, classId);
+    range.lastMethodMap = lowerBound(methodMaps, numMethodMaps, classId + 1);
+    return range;
+}
+
+Smoke::ModuleIndex Smoke::findMethod(ModuleIndex c, ModuleIndex name)
+{
+    if (!c.index || !name.index) {
+        return NullModuleIndex;
+    } else if (c.smoke != this) {
+        return c.smoke->findMethod(c, name);
+    }
+
+    MethodKey key = { c.index, name };
+    unsigned int hash = hashIndexPair(key.classId, key.name);
+    if (const MethodEntry *e = d->methodCache.find(key, hash))
+        return e->method;
+
+    unsigned int generation = moduleGeneration.load(std::memory_order_acquire);
+    MethodEntry *entry = new MethodEntry;
+    entry->k = key;
+    entry->hash = hash;
+    ModuleIndex method = resolveInheritedMethod(this, c, name);
+    entry->method = method;
+    d->methodCache.insert(entry, generation);
+    return method;
+}
+
+bool Smoke::isDerivedFrom(Smoke *smoke, Index classId, Smoke *baseSmoke, Index baseId)
+{
+    if (!classId || !baseId || !smoke || !baseSmoke)
+        return false;
+
+    const ModuleIndex& c = smoke->d->canonical[classId];
+    const ModuleIndex& base = baseSmoke->d->canonical[baseId];
+    if (c == base || c.smoke->d->hasAncestor(c.index, base))
+        return true;
+    if (c.smoke->d->incomplete[c.index])
+        return isDerivedFromSlow(smoke, classId, baseSmoke, baseId);
+    return false;
+}
+
+void *Smoke::cast(void *ptr, const ModuleIndex& from, const ModuleIndex& to)
+{
+    if (castFn == 0) {
+        return ptr;
+    }
+
+    if (from.smoke == to.smoke) {
+        return (*castFn)(ptr, from.index, to.index);
+    }
+
+    const ModuleIndex& target = to.smoke->d->canonical[to.index];
+    if (target.smoke == this) {
+        return (*castFn)(ptr, from.index, target.index);
+    }
+    unsigned int id = target.smoke->module_id;
+    if (id && id < d->externalIndex.size() && d->externalIndex[id].smoke == target.smoke) {
+        Index external = d->externalIndex[id].map[target.index];
+        if (external)
+            return (*castFn)(ptr, from.index, external);
+    }
+    // the class is unknown to this module, or wasn't resolved yet when it was loaded: keep the old behaviour
+    return (*castFn)(ptr, from.index, idClass(to.smoke->className(to.index), true).index);
+}
+
+int Smoke::callBatch(const Call *calls, int count, BatchCheck check, void *data)
+{
+    Index method = -1;  // no method is cached before the first call
+    MethodFn fn = 0;
+    ClassFn dispatch = 0;
+    Index xcallIndex = 0;
+    for (int i = 0; i < count; ++i) {
+        const Call& call = calls[i];
+        if (call.method != method) {
+            method = call.method;
+            fn = methodFns ? methodFns[method] : 0;
+            dispatch = classFn(methodClassId(method));
+            xcallIndex = methodCallIndex(method);
+        }
+        if (fn)
+            (*fn)(call.obj, call.args);
+        else
+            (*dispatch)(xcallIndex, call.obj, call.args);
+        if (check && !(*check)(call, data))
+            return i + 1;
+    }
+    return count;
+}
+
+void Smoke::addBindingType(const std::type_info& type)
+{
+    if (isBindingType(type))
+        return;
+    TypeEntry *entry = new TypeEntry;
+    entry->type = &type;
+    entry->hash = hashPointer(&type);
+    // the entry doesn't depend on the loaded modules, so the current generation is always right
+    bindingTypes().insert(entry, moduleGeneration.load(std::memory_order_acquire));
+}
+
+bool Smoke::isBindingType(const std::type_info& type)
+{
+    return bindingTypes().find(&type, hashPointer(&type)) != 0;
+}
+
+Smoke::ModuleIndex Smoke::resolveOverload(const ModuleIndex& classId, const char *name, const ArgType *args, int numArgs,
+                                          bool *ambiguous, CallSiteCache *cache)
+{
+    bool isAmbiguous = false;
+    if (!ambiguous)
+        ambiguous = &isAmbiguous;
+    *ambiguous = false;
+    if (!classId.smoke || !classId.index || !name)
+        return NullModuleIndex;
+
+    OverloadKey key = { canonicalClass(classId.smoke, classId.index), name, args, numArgs };
+    unsigned int generation = moduleGeneration.load(std::memory_order_acquire);
+    if (cache && cache->entry && cache->generation == generation) {
+        const OverloadEntry *e = static_cast<const OverloadEntry*>(cache->entry);
+        if (e->matches(key)) {
+            *ambiguous = e->ambiguous;
+            return e->method;
+        }
+    }
+
+    unsigned int hash = hashOverloadKey(key);
+    const OverloadEntry *e = overloadCache().find(key, hash);
+    // entries of an older generation can still be around until the cache has been cleared
+    if (!e || e->generation != generation) {
+        OverloadEntry *entry = new OverloadEntry(key, hash, generation);
+        ModuleIndex method = resolveOverloadUncached(key.classId, name, args, numArgs, ambiguous);
+        entry->method = method;
+        entry->ambiguous = *ambiguous;
+        // an unpublished entry is freed by the cache, so it mustn't be remembered in the call site cache either
+        if (!overloadCache().insert(entry, generation))
+            return method;
+        e = entry;
+    }
+
+    if (cache) {
+        cache->generation = generation;
+        cache->entry = e;
+    }
+    *ambiguous = e->ambiguous;
+    return e->method;
+}
+
+// Bounded multi-producer queue after Dmitry Vyukov: each slot has a sequence number telling whether it's free for
+// the producer at a position or filled for the consumer.
+struct SmokeDeletionQueue::Private {
+    struct Slot {
+        std::atomic<unsigned int> sequence;
+        Entry entry;
+    };
+
+    explicit Private(unsigned int size) : mask(size - 1), slots(new Slot[size]), head(0), tail(0) {
+        for (unsigned int i = 0; i < size; ++i)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ~Private() { delete[] slots; }
+
+    unsigned int mask;
+    Slot *slots;
+    std::atomic<unsigned int> head;     // next position to push to
+    unsigned int tail;                  // next position to drain, only used by the consumer
+};
+
+SmokeDeletionQueue::SmokeDeletionQueue(unsigned int capacity)
+{
+    unsigned int size = 2;
+    while (size < capacity)
+        size *= 2;
+    d = new Private(size);
+}
+
+SmokeDeletionQueue::~SmokeDeletionQueue()
+{
+    delete d;
+}
+
+bool SmokeDeletionQueue::push(Smoke::Index classId, void *obj)
+{
+    unsigned int pos = d->head.load(std::memory_order_relaxed);
+    for (;;) {
+        Private::Slot& slot = d->slots[pos & d->mask];
+        int diff = (int) (slot.sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (d->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.entry.classId = classId;
+                slot.entry.obj = obj;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the consumer hasn't drained this slot yet
+            return false;
+        } else {
+            pos = d->head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+int SmokeDeletionQueue::drain(Entry *entries, int max)
+{
+    int n = 0;
+    while (n < max) {
+        Private::Slot& slot = d->slots[d->tail & d->mask];
+        if (slot.sequence.load(std::memory_order_acquire) != d->tail + 1)
+            break;
+        entries[n++] = slot.entry;
+        slot.sequence.store(d->tail + d->mask + 1, std::memory_order_release);
+        ++d->tail;
+    }
+    return n;
+}
+
+namespace {
+
+// Layout of the images written by Smoke::writeImage(). All offsets are relative to the start of the image and
+// sections are aligned to 8 bytes. Methods, methodMaps, the index lists, classRanges and enumValues are stored as
+// their Smoke structs and used in place; classes and types contain pointers and are converted when loading.
+const char imageMagic[8] = { 'S', 'M', 'O', 'K', 'E', 'I', 'M', 'G' };
+const uint32_t imageVersion = 1;
+const uint32_t imageByteOrder = 0x01020304;
+
+enum ImageSection {
+    is_strings,
+    is_classNameOffsets,
+    is_typeNameOffsets,
+    is_methodNameOffsets,
+    is_classes,
+    is_methods,
+    is_methodMaps,
+    is_types,
+    is_inheritanceList,
+    is_argumentList,
+    is_ambiguousMethodList,
+    is_classRanges,
+    is_enumValues,
+    is_count
+};
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    // sizes of the structs stored as they are
+    uint32_t indexSize;
+    uint32_t methodSize;
+    uint32_t methodMapSize;
+    uint32_t classRangeSize;
+    uint32_t enumValueSize;
+    uint32_t moduleName;    // offset in strings
+    int32_t numClasses;
+    int32_t numMethods;
+    int32_t numMethodMaps;
+    int32_t numMethodNames;
+    int32_t numTypes;
+    int32_t numEnumValues;
+    uint32_t sectionOffset[is_count];
+    uint32_t sectionSize[is_count];
+};
+
+struct ImageClass {
+    uint32_t name;
+    int32_t parents;
+    uint32_t external;
+    uint32_t flags;
+    uint32_t size;
+    uint32_t alignment;
+};
+
+struct ImageType {
+    uint32_t name;
+    int32_t classId;
+    uint32_t flags;
+};
+
+class ImageWriter {
+public:
+    ImageWriter() : data(sizeof(ImageHeader), '\0'), strings(1, '\0') {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, imageMagic, sizeof(imageMagic));
+        header.version = imageVersion;
+        header.byteOrder = imageByteOrder;
+        header.indexSize = sizeof(Smoke::Index);
+        header.methodSize = sizeof(Smoke::Method);
+        header.methodMapSize = sizeof(Smoke::MethodMap);
+        header.classRangeSize = sizeof(Smoke::ClassRange);
+        header.enumValueSize = sizeof(Smoke::EnumValue);
+    }
+
+    // Returns the offset of s in the string blob, equal strings are stored once. Offset 0 is a null string.
+    uint32_t addString(const char *s) {
+        if (!s)
+            return 0;
+        std::unordered_map<std::string, uint32_t>::const_iterator it = stringOffsets.find(s);
+        if (it != stringOffsets.end())
+            return it->second;
+        uint32_t offset = strings.size();
+        strings.append(s, strlen(s) + 1);
+        stringOffsets[s] = offset;
+        return offset;
+    }
+
+    void addSection(ImageSection section, const void *p, size_t size) {
+        data.resize((data.size() + 7) & ~size_t(7), '\0');
+        header.sectionOffset[section] = data.size();
+        header.sectionSize[section] = size;
+        data.append((const char *) p, size);
+    }
+
+    template<typename T>
+    void addSection(ImageSection section, const std::vector<T>& v) {
+        addSection(section, v.data(), v.size() * sizeof(T));
+    }
+
+    bool write(const char *path) {
+        addSection(is_strings, strings.data(), strings.size());
+        memcpy(&data[0], &header, sizeof(header));
+        FILE *f = fopen(path, "wb");
+        if (!f)
+            return false;
+        bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+        return fclose(f) == 0 && ok;
+    }
+
+    ImageHeader header;
+
+private:
+    std::string data;
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> stringOffsets;
+};
+
+// Number of entries of a 0 terminated group list, given the start of each group.
+Smoke::Index groupListSize(const Smoke::Index *list, Smoke::Index start, Smoke::Index size)
+{
+    if (start <= 0)
+        return size;
+    while (list[start])
+        ++start;
+    return std::max(size, (Smoke::Index) (start + 1));
+}
+
+template<typename T>
+const T *imageSection(const char *image, const ImageHeader& header, ImageSection section)
+{
+    return header.sectionSize[section] ? (const T *) (image + header.sectionOffset[section]) : 0;
+}
+
+// Whether a section holding a 0 terminated group list has a valid size: at least the terminator, whole entries
+// and not more than an Index can address.
+bool isIndexListSection(uint32_t size)
+{
+    return size >= sizeof(Smoke::Index) && size % sizeof(Smoke::Index) == 0
+        && size / sizeof(Smoke::Index) <= (uint32_t) std::numeric_limits<Smoke::Index>::max();
+}
+
+bool isValidImage(const char *image, size_t size)
+{
+    if (size < sizeof(ImageHeader))
+        return false;
+    const ImageHeader& header = *(const ImageHeader *) image;
+    if (memcmp(header.magic, imageMagic, sizeof(imageMagic)) != 0 || header.version != imageVersion
+        || header.byteOrder != imageByteOrder || header.indexSize != sizeof(Smoke::Index)
+        || header.methodSize != sizeof(Smoke::Method) || header.methodMapSize != sizeof(Smoke::MethodMap)
+        || header.classRangeSize != sizeof(Smoke::ClassRange) || header.enumValueSize != sizeof(Smoke::EnumValue))
+    {
+        return false;
+    }
+    for (int i = 0; i < is_count; ++i) {
+        if (header.sectionOffset[i] % 8 != 0 || header.sectionOffset[i] > size
+            || header.sectionSize[i] > size - header.sectionOffset[i])
+        {
+            return false;
+        }
+    }
+    const int32_t maxIndex = std::numeric_limits<Smoke::Index>::max();
+    if (header.numClasses < 0 || header.numClasses >= maxIndex || header.numTypes < 0 || header.numTypes >= maxIndex
+        || header.numMethodNames < 0 || header.numMethodNames >= maxIndex || header.numMethods < 0
+        || header.numMethods > maxIndex || header.numMethodMaps < 0 || header.numMethodMaps > maxIndex
+        || header.numEnumValues < 0 || header.numEnumValues > maxIndex)
+    {
+        return false;
+    }
+    const uint32_t *sizes = header.sectionSize;
+    return sizes[is_strings] && image[header.sectionOffset[is_strings] + sizes[is_strings] - 1] == '\0'
+        && header.moduleName < sizes[is_strings]
+        && sizes[is_classes] == (header.numClasses + 1) * sizeof(ImageClass)
+        && sizes[is_classNameOffsets] == (header.numClasses + 1) * sizeof(uint32_t)
+        && sizes[is_types] == (header.numTypes + 1) * sizeof(ImageType)
+        && sizes[is_typeNameOffsets] == (header.numTypes + 1) * sizeof(uint32_t)
+        && sizes[is_methodNameOffsets] == (header.numMethodNames + 1) * sizeof(uint32_t)
+        && sizes[is_methods] == header.numMethods * sizeof(Smoke::Method)
+        && sizes[is_methodMaps] == header.numMethodMaps * sizeof(Smoke::MethodMap)
+        && sizes[is_classRanges] == (header.numClasses + 1) * sizeof(Smoke::ClassRange)
+        && sizes[is_enumValues] == header.numEnumValues * sizeof(Smoke::EnumValue)
+        && isIndexListSection(sizes[is_inheritanceList]) && isIndexListSection(sizes[is_argumentList])
+        && isIndexListSection(sizes[is_ambiguousMethodList]);
+}
+
+inline bool inRange(int32_t i, int32_t min, int32_t max)
+{
+    return i >= min && i <= max;
+}
+
+// Whether all indices in a 0 terminated group list are in [0, max].
+bool isValidGroupList(const Smoke::Index *list, int32_t size, int32_t max)
+{
+    for (int32_t i = 0; i < size; ++i) {
+        if (!inRange(list[i], 0, max))
+            return false;
+    }
+    return list[size - 1] == 0;
+}
+
+// Checks the contents of an image that passed isValidImage(): all string offsets have to be in the string
+// section, all indices in the tables they refer to and the class ranges in methods and methodMaps.
+bool hasValidTables(const char *image)
+{
+    const ImageHeader& header = *(const ImageHeader *) image;
+    const uint32_t *sizes = header.sectionSize;
+    const uint32_t stringsSize = sizes[is_strings];
+    const int32_t numClasses = header.numClasses;
+    const int32_t numTypes = header.numTypes;
+    const int32_t numMethodNames = header.numMethodNames;
+    const int32_t numInheritance = sizes[is_inheritanceList] / sizeof(Smoke::Index);
+    const int32_t numArguments = sizes[is_argumentList] / sizeof(Smoke::Index);
+    const int32_t numAmbiguous = sizes[is_ambiguousMethodList] / sizeof(Smoke::Index);
+
+    const ImageSection nameSections[] = { is_classNameOffsets, is_typeNameOffsets, is_methodNameOffsets };
+    for (size_t s = 0; s < sizeof(nameSections) / sizeof(nameSections[0]); ++s) {
+        if (sizes[nameSections[s]] % sizeof(uint32_t) != 0)
+            return false;
+        const uint32_t *offsets = imageSection<uint32_t>(image, header, nameSections[s]);
+        for (uint32_t i = 0; i < sizes[nameSections[s]] / sizeof(uint32_t); ++i) {
+            if (offsets[i] >= stringsSize)
+                return false;
+        }
+    }
+
+    const ImageClass *classes = imageSection<ImageClass>(image, header, is_classes);
+    for (int32_t i = 0; i <= numClasses; ++i) {
+        if (classes[i].name >= stringsSize || !inRange(classes[i].parents, 0, numInheritance - 1))
+            return false;
+    }
+    const ImageType *types = imageSection<ImageType>(image, header, is_types);
+    for (int32_t i = 0; i <= numTypes; ++i) {
+        if (types[i].name >= stringsSize || !inRange(types[i].classId, -1, numClasses))
+            return false;
+    }
+
+    if (!isValidGroupList(imageSection<Smoke::Index>(image, header, is_inheritanceList), numInheritance, numClasses)
+        || !isValidGroupList(imageSection<Smoke::Index>(image, header, is_argumentList), numArguments, numTypes)
+        || !isValidGroupList(imageSection<Smoke::Index>(image, header, is_ambiguousMethodList), numAmbiguous,
+                             header.numMethods - 1))
+    {
+        return false;
+    }
+
+    const Smoke::Method *methods = imageSection<Smoke::Method>(image, header, is_methods);
+    for (int32_t i = 0; i < header.numMethods; ++i) {
+        const Smoke::Method& m = methods[i];
+        if (!inRange(m.classId, 0, numClasses) || !inRange(m.name, 0, numMethodNames) || !inRange(m.ret, 0, numTypes)
+            || !inRange(m.args, 0, numArguments - 1) || m.args + m.numArgs >= numArguments)
+        {
+            return false;
+        }
+    }
+    const Smoke::MethodMap *methodMaps = imageSection<Smoke::MethodMap>(image, header, is_methodMaps);
+    for (int32_t i = 0; i < header.numMethodMaps; ++i) {
+        const Smoke::MethodMap& m = methodMaps[i];
+        if (!inRange(m.classId, 0, numClasses) || !inRange(m.name, 0, numMethodNames)
+            || !inRange(m.method, -(numAmbiguous - 1), header.numMethods - 1))
+        {
+            return false;
+        }
+    }
+
+    const Smoke::ClassRange *ranges = imageSection<Smoke::ClassRange>(image, header, is_classRanges);
+    for (int32_t i = 0; i <= numClasses; ++i) {
+        const Smoke::ClassRange& r = ranges[i];
+        if (!inRange(r.firstMethod, 0, header.numMethods) || !inRange(r.lastMethod, r.firstMethod, header.numMethods)
+            || !inRange(r.firstMethodMap, 0, header.numMethodMaps)
+            || !inRange(r.lastMethodMap, r.firstMethodMap, header.numMethodMaps))
+        {
+            return false;
+        }
+    }
+    const Smoke::EnumValue *enumValues = imageSection<Smoke::EnumValue>(image, header, is_enumValues);
+    for (int32_t i = 0; i < header.numEnumValues; ++i) {
+        const Smoke::EnumValue& v = enumValues[i];
+        if (!inRange(v.classId, 0, numClasses) || !inRange(v.name, 0, numMethodNames) || !inRange(v.type, 0, numTypes))
+            return false;
+    }
+    return true;
+}
+
+}
+
+bool Smoke::writeImage(const char *path)
+{
+    ImageWriter writer;
+    ImageHeader& header = writer.header;
+    header.moduleName = writer.addString(module_name);
+    header.numClasses = numClasses;
+    header.numMethods = numMethods;
+    header.numMethodMaps = numMethodMaps;
+    header.numMethodNames = numMethodNames;
+    header.numTypes = numTypes;
+    header.numEnumValues = enumValues ? numEnumValues : 0;
+
+    std::vector<ImageClass> imageClasses(numClasses + 1);
+    std::vector<uint32_t> classNames(numClasses + 1);
+    Index inheritanceSize = 1;
+    for (Index i = 0; i <= numClasses; ++i) {
+        const Class& c = classes[i];
+        ImageClass ic = { writer.addString(className(i)), c.parents, c.external, c.flags, c.size, c.alignment };
+        imageClasses[i] = ic;
+        classNames[i] = ic.name;
+        inheritanceSize = groupListSize(inheritanceList, c.parents, inheritanceSize);
+    }
+
+    std::vector<ImageType> imageTypes(numTypes + 1);
+    std::vector<uint32_t> typeNames(numTypes + 1);
+    for (Index i = 0; i <= numTypes; ++i) {
+        ImageType it = { writer.addString(typeName(i)), typeClassId(i), typeFlags(i) };
+        imageTypes[i] = it;
+        typeNames[i] = it.name;
+    }
+
+    std::vector<uint32_t> methodNameOffsets(numMethodNames + 1);
+    for (Index i = 0; i <= numMethodNames; ++i)
+        methodNameOffsets[i] = writer.addString(methodName(i));
+
+    // modules generated with -hc have no methods array, only the columns of their hot tables
+    std::vector<Method> imageMethods(numMethods);
+    Index argumentSize = 1;
+    for (Index i = 0; i < numMethods; ++i) {
+        // field by field, the value-initialized entries keep their padding zeroed
+        Method& m = imageMethods[i];
+        m.classId = methodClassId(i);
+        m.name = methodNameId(i);
+        m.args = methodArgs(i);
+        m.numArgs = methodNumArgs(i);
+        m.flags = methodFlags(i);
+        m.ret = methodReturnType(i);
+        m.method = methodCallIndex(i);
+        m.signature = methodSignature(i);
+        if (i && m.numArgs)
+            argumentSize = std::max(argumentSize, (Index) (m.args + m.numArgs + 1));
+    }
+    Index ambiguousSize = 1;
+    for (Index i = 1; i < numMethodMaps; ++i)
+        ambiguousSize = groupListSize(ambiguousMethodList, -methodMaps[i].method, ambiguousSize);
+
+    writer.addSection(is_classNameOffsets, classNames);
+    writer.addSection(is_typeNameOffsets, typeNames);
+    writer.addSection(is_methodNameOffsets, methodNameOffsets);
+    writer.addSection(is_classes, imageClasses);
+    writer.addSection(is_methods, imageMethods);
+    writer.addSection(is_methodMaps, methodMaps, numMethodMaps * sizeof(MethodMap));
+    writer.addSection(is_types, imageTypes);
+    writer.addSection(is_inheritanceList, inheritanceList, inheritanceSize * sizeof(Index));
+    writer.addSection(is_argumentList, argumentList, argumentSize * sizeof(Index));
+    writer.addSection(is_ambiguousMethodList, ambiguousMethodList, ambiguousSize * sizeof(Index));
+    // images always have class ranges, so loaded modules don't need the binary search fallback
+    std::vector<ClassRange> imageRanges(numClasses + 1);
+    for (Index i = 0; i <= numClasses; ++i)
+        imageRanges[i] = classRange(i);
+    writer.addSection(is_classRanges, imageRanges);
+    if (enumValues)
+        writer.addSection(is_enumValues, enumValues, numEnumValues * sizeof(EnumValue));
+    return writer.write(path);
+}
+
+Smoke *Smoke::loadImage(const char *path)
+{
+    size_t size = 0;
+    char *image = mapImage(path, &size);
+    if (!image)
+        return 0;
+    if (!isValidImage(image, size) || !hasValidTables(image)) {
+        fprintf(stderr, "smokebase: '%s' isn't a module image for this version of smokebase\n", path);
+        unmapImage(image, size);
+        return 0;
+    }
+
+    const ImageHeader& header = *(const ImageHeader *) image;
+    const char *strings = imageSection<char>(image, header, is_strings);
+
+    std::vector<Class> classes(header.numClasses + 1);
+    const ImageClass *imageClasses = imageSection<ImageClass>(image, header, is_classes);
+    for (Index i = 0; i <= header.numClasses; ++i) {
+        const ImageClass& ic = imageClasses[i];
+        Class c = { 0, ic.external != 0, (Index) ic.parents, 0, 0, (unsigned short) ic.flags, ic.size, ic.alignment };
+        classes[i] = c;
+    }
+    std::vector<Type> types(header.numTypes + 1);
+    const ImageType *imageTypes = imageSection<ImageType>(image, header, is_types);
+    for (Index i = 0; i <= header.numTypes; ++i) {
+        Type t = { 0, (Index) imageTypes[i].classId, (unsigned short) imageTypes[i].flags };
+        types[i] = t;
+    }
+
+    // the tables aren't modified, the casts only drop the const of the read-only mapping
+    Smoke *smoke = new Smoke(strings + header.moduleName,
+                             classes.data(), header.numClasses,
+                             (Method *) imageSection<Method>(image, header, is_methods), header.numMethods,
+                             (MethodMap *) imageSection<MethodMap>(image, header, is_methodMaps), header.numMethodMaps,
+                             0, header.numMethodNames,
+                             types.data(), header.numTypes,
+                             (Index *) imageSection<Index>(image, header, is_inheritanceList),
+                             (Index *) imageSection<Index>(image, header, is_argumentList),
+                             (Index *) imageSection<Index>(image, header, is_ambiguousMethodList),
+                             0,
+                             strings,
+                             imageSection<uint32_t>(image, header, is_classNameOffsets),
+                             imageSection<uint32_t>(image, header, is_typeNameOffsets),
+                             imageSection<uint32_t>(image, header, is_methodNameOffsets));
+    smoke->classRanges = (ClassRange *) imageSection<ClassRange>(image, header, is_classRanges);
+    smoke->enumValues = (EnumValue *) imageSection<EnumValue>(image, header, is_enumValues);
+    smoke->numEnumValues = header.numEnumValues;
+    // the vectors keep their buffers when swapped, so the pointers passed above stay valid
+    smoke->d->image = image;
+    smoke->d->imageSize = size;
+    smoke->d->imageClasses.swap(classes);
+    smoke->d->imageTypes.swap(types);
+    return smoke;
+}
@@ -186,6 +186,7 @@ public:
         Static = 0x4,
         DynamicDispatch = 0x8,
         Explicit = 0x10,
+        BitField = 0x20,
     };
     Q_DECLARE_FLAGS(Flags, Flag)
 